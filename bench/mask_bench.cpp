@@ -0,0 +1,90 @@
+// Throughput of Mask::mask/unmask for every kernel table this CPU can run,
+// checked byte for byte against the original whole-buffer loops.
+//
+//   mask_bench [MiB]
+
+#include "mask.hpp"
+#include "mask_simd.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static void referenceMask(const Mask& m, unsigned char* buffer, long long len) {
+    if (m.version < 2) {
+        for (long long i = 1; i < len; i++) buffer[i] += buffer[i - 1];
+        for (long long i = 0; i < len; i++) buffer[i] = m.mapping[buffer[i]];
+    }
+    if (m.version == 1) {
+        unsigned short e = 1;
+        for (long long i = 0; i < len; i++) {
+            buffer[i] += e;
+            e = ((e * 101) & 255);
+        }
+    }
+    else if (m.version == 2) {
+        Xoshiro256ppByteStream bs(m.seed());
+        for (long long i = 0; i < len; i++) buffer[i] += bs.next_byte();
+    }
+    if (m.version >= 2) {
+        unsigned char acc = 10;
+        for (long long i = 0; i < len; i++) {
+            buffer[i] = m.mapping[(buffer[i] + acc) & 0xFF];
+            acc ^= buffer[i];
+        }
+        for (long long i = 0; i < len; i++) buffer[i] = m.mapping[buffer[i]];
+    }
+    for (long long i = 1; i < len; i++) buffer[i] ^= buffer[i - 1];
+    for (long long i = len - 1; i > 0; i--) {
+        long long lb = ((i + 1) & -(i + 1));
+        if (lb != i + 1) buffer[i] ^= buffer[i - lb];
+    }
+}
+
+static double seconds(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+int main(int argc, char** argv) {
+    size_t size = (argc > 1 ? std::strtoull(argv[1], nullptr, 0) : 64) << 20;
+
+    std::mt19937_64 rng(2009);
+    Mask m;
+    for (int i = 0; i < 256; i++) m.mapping[i] = i;
+    for (int i = 255; i > 0; i--) std::swap(m.mapping[i], m.mapping[rng() % (i + 1)]);
+    for (int i = 0; i < 256; i++) m.rmapping[m.mapping[i]] = i;
+
+    std::vector<unsigned char> plain(size), expect, buf;
+    for (auto& c : plain) c = rng();
+
+    bool ok = true;
+    for (const char* name : {"scalar", "sse2", "avx2"}) {
+        if (!selectMaskKernels(name)) {
+            std::printf("%-7s unsupported\n", name);
+            continue;
+        }
+        for (int version = 0; version <= 2; version++) {
+            m.versionId(version);
+            expect = plain;
+            referenceMask(m, expect.data(), expect.size());
+
+            buf = plain;
+            auto t0 = std::chrono::steady_clock::now();
+            m.mask(buf.data(), buf.size());
+            double tm = seconds(t0);
+            bool same = buf == expect;
+
+            t0 = std::chrono::steady_clock::now();
+            m.unmask(buf.data(), buf.size());
+            double tu = seconds(t0);
+            same = same && buf == plain;
+            ok = ok && same;
+
+            std::printf("%-7s v%d  mask %6.3f GB/s  unmask %6.3f GB/s  %s\n", name, version,
+                size / tm / 1e9, size / tu / 1e9, same ? "identical" : "MISMATCH");
+        }
+    }
+    return ok ? 0 : 1;
+}
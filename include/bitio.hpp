@@ -1,24 +1,43 @@
 #pragma once
 
-#include <fstream>
+#include <ostream>
+#include <istream>
+#include <cstddef>
 
+// Bit fields are packed MSB first. Both classes work on a memory span and
+// move whole 64-bit words; the stream constructors are adapters that only
+// touch the bytes actually packed or consumed.
 class BitOutput {
 private:
-    std::ofstream& os;
-    unsigned char data;
-    unsigned char bufferLength;
+    unsigned char* out;
+    size_t cap, pos;
+    std::ostream* os;
+    unsigned char chunk[8];
+    unsigned long long word;
+    unsigned char bits;
+
+    void put(unsigned char byte);
+    void drain();
 public:
     void write(unsigned short adata, unsigned char len);
-    BitOutput(std::ofstream& os);
+    size_t finish();
+    BitOutput(unsigned char* out, size_t cap);
+    BitOutput(std::ostream& os);
     ~BitOutput();
 };
 
 class BitInput {
 private:
-    std::ifstream& is;
-    unsigned char data;
-    unsigned char bufferLength;
+    const unsigned char* in;
+    size_t len, pos;
+    std::istream* is;
+    unsigned char chunk[8];
+    unsigned long long word;
+    unsigned char bits;
+
+    void refill(unsigned char need);
 public:
     unsigned short read(unsigned char len);
-    BitInput(std::ifstream& is);
-};
\ No newline at end of file
+    BitInput(const unsigned char* in, size_t len);
+    BitInput(std::istream& is);
+};
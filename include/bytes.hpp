@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+// Little-endian fields used by the FS table and the trailer sections.
+namespace LE {
+    inline void put(std::vector<unsigned char>& out, unsigned long long val, size_t bytes) {
+        for (size_t i = 0; i < bytes; i++) {
+            out.push_back((val >> (i << 3)) & 0xff);
+        }
+    }
+
+    inline unsigned long long get(const unsigned char* in, size_t bytes) {
+        unsigned long long val = 0;
+        for (size_t i = 0; i < bytes; i++) {
+            val |= ((unsigned long long) in[i]) << (i << 3);
+        }
+        return val;
+    }
+}
+
+// LEB128 varints used by the compact FS table.
+namespace Varint {
+    inline void put(std::vector<unsigned char>& out, unsigned long long val) {
+        while (val >= 0x80) {
+            out.push_back((val & 0x7f) | 0x80);
+            val >>= 7;
+        }
+        out.push_back(val);
+    }
+
+    // Advances `in`; false if the varint runs past `end` or 64 bits.
+    inline bool get(const unsigned char*& in, const unsigned char* end, unsigned long long& val) {
+        val = 0;
+        for (unsigned int shift = 0; in < end && shift < 64; shift += 7) {
+            unsigned char byte = *in++;
+            val |= ((unsigned long long) (byte & 0x7f)) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 namespace Conf {
 constexpr unsigned char 
     ENCRYPTED = 64,
@@ -11,7 +13,84 @@ constexpr unsigned char
     NETWORK = 1;
 }
 
+// Standard version 3 appends tagged sections after the FS table end tag:
+// [u32 id][u64 size][payload] ..., closed by a bare END id.
+// Version 4 replaces the name/offset list with one block, [u64 size] then
+// varint entry count, varint name count, the deduplicated names as
+// [varint length][bytes], and per entry [varint name id][varint offset
+// delta]; the sections follow the block.
+// Version 5 adds solid blocks: SOLID lists [u32 fsid][u32 block][u32 offset]
+// [u32 size] per member, where the block is the payload of the member
+// `block`, the last one of its run; the other members have no payload.
+// Version 6 adds DEDUP, [u32 fsid][u32 source] per entry that has no
+// payload of its own and reads that of `source`, an identical file.
+// Version 7 adds seekable entries: FRAMES lists [u32 fsid][u32 frame size]
+// [u32 count] then count [u64 end] offsets into the payload. Each frame is
+// frame size bytes of the file (the last may be shorter), compressed,
+// encrypted and masked on its own.
+// STAT holds [u64 size][u64 mtime] per fsid as seen when it was packed;
+// update mode reuses entries whose file still matches. Entries replaced by
+// an update stay in the archive but are no longer reachable.
+// NODES holds a [u8 prop][u64 stored size][u64 raw size][u32 parent] record
+// per fsid, so the tree is known without touching the entries.
+namespace Section {
+constexpr unsigned int
+    END = 0,
+    KEYS = 1,
+    PATHS = 2,
+    NODES = 3,
+    SOLID = 4,
+    DICT = 5,
+    DEDUP = 6,
+    STAT = 7,
+    FRAMES = 8;
+}
+
+// Per key index encryption scheme, recorded in the KEYS section.
+namespace KeyScheme {
+constexpr unsigned char
+    DERIVED = 1,
+    GCM = 2;
+}
+
 const int SALT_SIZE = 16;
 const int IV_SIZE = 16;
 const int KEY_SIZE = 16;
-const int PBKDF2_ITERATIONS = 100000;
\ No newline at end of file
+const int GCM_IV_SIZE = 12;
+const int TAG_SIZE = 16;
+const int PBKDF2_ITERATIONS = 100000;
+const int MASTER_KEY_SIZE = 32;
+const char ENTRY_KEY_INFO[] = "MKAR entry key";
+
+// Payloads are masked this many times; version 0 archives only once.
+const int MASK_ROUNDS = 3;
+
+// Entries larger than this are streamed through windows of this size.
+const size_t STREAM_BUFFER_SIZE = 64 << 20;
+
+// Dictionary training reads at most this much of each file, and samples
+// up to DICT_SAMPLE_RATIO times the dictionary size in total.
+const size_t DICT_SAMPLE_LIMIT = 128 << 10;
+const size_t DICT_SAMPLE_RATIO = 100;
+
+// Adaptive compression trial-compresses the first ADAPTIVE_SAMPLE_SIZE
+// bytes of an entry at ADAPTIVE_FAST_LEVEL. Entries whose sample doesn't
+// shrink below ADAPTIVE_STORE_RATIO are stored, those below
+// ADAPTIVE_HIGH_RATIO get the archive level, the rest the fast level.
+const size_t ADAPTIVE_SAMPLE_SIZE = 64 << 10;
+const int ADAPTIVE_FAST_LEVEL = 3;
+const double ADAPTIVE_STORE_RATIO = 0.95;
+const double ADAPTIVE_HIGH_RATIO = 0.6;
+
+// Decompressed solid blocks kept by the reader.
+const size_t SOLID_CACHE_BLOCKS = 4;
+
+// Bytes of whole decoded entries DArchive::ReadRange keeps around.
+const size_t ENTRY_CACHE_BYTES = 256 << 20;
+
+// Per-entry PBKDF2 keys the reader keeps, by key index and salt. The
+// frames of a seekable entry share one.
+const size_t KEY_CACHE_ENTRIES = 64;
+
+// NETWORK entries fetched at the same time while extracting.
+const unsigned int DOWNLOAD_CONNECTIONS = 8;
\ No newline at end of file
@@ -6,6 +6,16 @@
 #include <map>
 #include <queue>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <set>
+#include <memory>
+#include <condition_variable>
+#include <string_view>
+#include <istream>
+#include <iterator>
+#include "mapped_file.hpp"
 
 #if defined(_WIN32) || defined(__CYGWIN__)
     #if defined(LIB_EXPORTS)
@@ -21,26 +31,142 @@
     #endif
 #endif
 
+class ExtractPool;
+class DownloadPool;
+struct ZSTD_DDict_s;
+struct ZSTD_DCtx_s;
+
 class DArchive {
+    friend class ExtractPool;
+    friend class EArchive;
 private:
+    // Tree structure of an entry, decoded at most once. Files only need the
+    // prop; directories and symlinks also carry their decoded payload.
+    struct NodeInfo {
+        bool known = false, loaded = false;
+        unsigned char prop = 0;
+        unsigned int parent = 0xffffffff, link = 0xffffffff, resolved = 0xffffffff;
+        unsigned long long rawSize = (unsigned long long) -1;
+        std::vector<unsigned int> children;
+    };
     unsigned int fileCount;
     unsigned long long fstOffset;
-    std::vector<std::string> fileNames;
+    std::vector<std::string_view> fileNames;
+    std::vector<unsigned char> tableBlock;
     std::vector<unsigned int> rootdir;
     std::vector<size_t> fileSizes;
     std::vector<size_t> fileOffsets;
     std::map<unsigned int, std::string> keys;
     std::vector<std::tuple<unsigned int, std::string, std::string>> tasks;
     std::ifstream is;
-    bool good, safeMode, curlState;
+    MappedFile map;
+    std::string archiveName;
+    std::atomic<bool> good;
+    bool safeMode, curlState, quiet;
+    std::function<bool(unsigned int)> missingPassword, incorrectPassword;
+    std::recursive_mutex nodeLock;
     int arcVersion;
+    unsigned int threads, connections;
+    size_t bufferSize;
+    std::recursive_mutex keyLock;
+    std::map<unsigned int, std::pair<unsigned long long, unsigned long long>> sections;
+    std::map<unsigned int, std::pair<unsigned char, std::vector<unsigned char>>> keySchemes;
+    std::map<unsigned int, std::pair<std::string, std::vector<unsigned char>>> masterKeys;
+    std::map<std::string, std::pair<std::string, std::vector<unsigned char>>> saltKeys;
+    std::vector<unsigned char> pathIndex;
+    std::vector<NodeInfo> nodes;
+    ZSTD_DDict_s* ddict;
+    struct SolidRef {
+        unsigned int block = 0xffffffff;
+        size_t offset = 0, size = 0;
+    };
+    std::vector<SolidRef> solidRefs;
+    struct FrameRef {
+        size_t frameSize = 0;
+        std::vector<unsigned long long> ends;
+    };
+    std::vector<FrameRef> frameRefs;
+    std::vector<unsigned int> dedupSources;
+    std::list<std::tuple<unsigned int, size_t, std::shared_ptr<unsigned char[]>>> blockCache;
+    std::set<unsigned int> blockLoading;
+    std::mutex blockLock;
+    std::condition_variable blockLoaded;
+    std::list<std::tuple<unsigned int, size_t, std::shared_ptr<unsigned char[]>>> entryCache;
+    std::map<unsigned int, decltype(entryCache)::iterator> entryIndex;
+    size_t entryCached;
+    std::mutex entryLock;
     std::queue<std::pair<unsigned int, std::filesystem::path>> routines;
+    std::unique_ptr<DownloadPool> downloads;
 private:
+    ZSTD_DCtx_s* threadDCtx();
     std::pair<size_t, unsigned char*> decompress_data(const unsigned char* in, size_t len);
     std::pair<size_t, unsigned char*> decrypt_data(const unsigned char* in, size_t len);
-    bool download(std::string url, std::filesystem::path save);
+    std::pair<size_t, unsigned char*> decrypt_gcm(const unsigned char* in, size_t len, unsigned int kix);
+    unsigned char schemeOf(unsigned int kix);
+    std::string passwordOf(unsigned int kix);
+    bool retryPassword(unsigned int kix, std::string& password);
+    void entryKey(unsigned int kix, const std::string& password, const unsigned char* salt, unsigned char* key);
+    size_t readTable();
+    size_t readLegacyTable();
+    void readSections(size_t offset);
+    bool readSection(unsigned int id, std::vector<unsigned char>& data);
+    void finishDownloads();
     std::pair<size_t, unsigned char*> extractData(unsigned int fsid, unsigned char& prop);
+    std::pair<size_t, unsigned char*> extractData(unsigned int fsid, unsigned char& prop, std::istream& in);
+    std::pair<size_t, unsigned char*> decodeEntry(unsigned int fsid, unsigned char& prop, std::istream& in);
+    std::pair<size_t, unsigned char*> decodePayload(unsigned char prop, unsigned char* data, size_t size, unsigned char* dest = nullptr, size_t capacity = 0);
+    std::pair<size_t, unsigned char*> decodeFrame(unsigned int fsid, size_t index, unsigned char& prop, std::istream& in, unsigned char* dest = nullptr, size_t capacity = 0);
+    bool isFramed(unsigned int fsid);
+    std::pair<size_t, std::shared_ptr<unsigned char[]>> solidBlock(unsigned int block, std::istream& in);
+    std::pair<size_t, std::shared_ptr<unsigned char[]>> cachedEntry(unsigned int fsid);
+    bool isSolid(unsigned int fsid);
+    unsigned int payloadOf(unsigned int fsid);
+    unsigned char peekProp(unsigned int fsid);
+    unsigned int keyIndexOf(unsigned int fsid);
+    const NodeInfo* nodeOf(unsigned int fsid);
+    const NodeInfo* resolveNode(unsigned int fsid);
+    void readAt(std::istream& in, size_t offset, void* buf, size_t len);
+    std::istream& readerStream(std::ifstream& local);
+    void extractNode(unsigned int fsid, std::filesystem::path path, ExtractPool* pool);
+    void writeFile(unsigned char prop, unsigned char* data, size_t size, const std::filesystem::path& path);
+    void extractFile(unsigned int fsid, const std::filesystem::path& path, std::istream& in);
+    void streamFile(unsigned int fsid, const std::filesystem::path& path, std::istream& in);
+    void writeFrames(unsigned int fsid, const std::filesystem::path& path, std::istream& in);
+    void runScript(const std::string& src, const std::string& title);
 public:
+    // One entry of a depth-first walk over the archive tree, roots first.
+    struct Entry {
+        unsigned int fsid;
+        std::string path;
+        bool directory, symlink;
+        unsigned long long size;
+    };
+    class iterator {
+    private:
+        DArchive* arch;
+        std::vector<std::pair<unsigned int, std::string>> pending;
+        Entry current;
+        void next();
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Entry;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Entry*;
+        using reference = const Entry&;
+        iterator(DArchive* arch = nullptr);
+        reference operator*() const { return current; }
+        pointer operator->() const { return &current; }
+        iterator& operator++() { next(); return *this; }
+        bool operator==(const iterator& other) const { return arch == other.arch && (!arch || current.fsid == other.current.fsid); }
+        bool operator!=(const iterator& other) const { return !(*this == other); }
+    };
+    iterator begin();
+    iterator end();
+    // Decoded contents of an entry, symlinks followed, without touching
+    // the disk. These calls may be made from several threads at once.
+    std::pair<size_t, std::shared_ptr<unsigned char[]>> ReadEntry(unsigned int fsid);
+    std::unique_ptr<std::istream> OpenEntry(unsigned int fsid);
+    void SetPasswordCallbacks(std::function<bool(unsigned int)> missing, std::function<bool(unsigned int)> incorrect);
     bool isGood();
     void FSTable();
     void TestRootdir();
@@ -52,12 +178,18 @@ public:
     void Safe();
     void AddRoutine(unsigned int fsid, std::filesystem::path path);
     void RunRoutines();
+    void SetThreads(unsigned int count);
+    void SetConnections(unsigned int count);
+    void SetBufferSize(size_t size);
     bool isDirectory(unsigned int fsid);
     bool isSymlink(unsigned int fsid);
+    unsigned int resolveLink(unsigned int fsid);
     std::vector<unsigned int> listDirectory(int fsid);
     std::string getName(unsigned int fsid);
+    unsigned long long getSize(unsigned int fsid);
+    size_t ReadRange(unsigned int fsid, unsigned long long offset, void* buf, size_t len);
     unsigned int FSCount();
-    DArchive(std::string name);
+    DArchive(std::string name, bool quiet = false);
     ~DArchive();
 };
 
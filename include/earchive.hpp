@@ -6,6 +6,27 @@
 #include <fstream>
 #include <queue>
 #include <functional>
+#include <string>
+#include <mutex>
+#include <tuple>
+#include <atomic>
+#include <memory>
+
+struct ZSTD_CDict_s;
+class DArchive;
+class Mask;
+struct ZSTD_CCtx_s;
+
+struct PackedEntry {
+    std::string header;
+    unsigned char* content;
+    size_t size, rawSize;
+    unsigned char prop;
+    std::string digest;
+    std::vector<unsigned long long> frames;
+    unsigned int source;
+    bool ok, streamed, solid;
+};
 
 class EArchive {
 private:
@@ -13,6 +34,8 @@ private:
     size_t prevSize;
     std::vector<std::string> fileNames;
     std::vector<size_t> fileOffsets;
+    std::vector<unsigned char> fileProps;
+    std::vector<size_t> fileSizes, rawSizes;
     std::vector<std::vector<unsigned int>> subs;
     std::map<std::string, unsigned char> props;
     std::map<unsigned int, std::string> keys;
@@ -23,9 +46,73 @@ private:
     bool good;
     std::queue<std::filesystem::path> routines;
     unsigned char maskProp;
+    unsigned int threads;
+    size_t bufferSize;
+    unsigned char keyScheme;
+    bool pathIndex;
+    size_t solidSize;
+    size_t dictSize;
+    std::vector<unsigned char> dict;
+    ZSTD_CDict_s* cdict;
+    ZSTD_CDict_s* fastCDict;
+    int level, windowLog, zstdWorkers;
+    bool longMatching;
+    bool adaptive;
+    enum class Choice { STORE, FAST, HIGH };
+    struct CompressStats {
+        std::atomic<unsigned long long> rawBytes{0}, packedBytes{0}, nanos{0};
+        std::atomic<unsigned int> stored{0}, fast{0}, high{0};
+    };
+    mutable CompressStats stats;
+    bool dedup;
+    bool updating;
+    std::string archivePath;
+    size_t archiveEnd;
+    unsigned int oldCount;
+    bool oldEncrypted;
+    std::unique_ptr<DArchive> previous;
+    std::vector<unsigned int> oldRoots;
+    std::vector<std::filesystem::path> updates;
+    std::vector<std::pair<unsigned long long, unsigned long long>> fileStats;
+    mutable std::mutex dedupLock;
+    std::map<std::string, unsigned int> payloads;
+    std::vector<std::pair<unsigned int, unsigned int>> dedupRefs;
+    std::vector<unsigned char> block;
+    std::string blockHeader;
+    size_t blockFirst;
+    std::vector<std::tuple<unsigned int, unsigned int, size_t, size_t>> solidRefs;
+    size_t frameSize;
+    std::vector<std::tuple<unsigned int, size_t, std::vector<unsigned long long>>> frameRefs;
+    mutable std::mutex keyLock;
+    mutable std::map<unsigned int, std::vector<unsigned char>> masterKeys, keySalts;
 private:
-    std::pair<size_t, unsigned char*> compress_data(const unsigned char* in, size_t len);
-    std::pair<size_t, unsigned char*> encrypt_data(const unsigned char* in, size_t len, unsigned int key);
+    ZSTD_CCtx_s* threadCCtx(int level, bool useDict = true) const;
+    std::pair<size_t, unsigned char*> compress_data(const unsigned char* in, size_t len, int level, bool useDict = true) const;
+    Choice chooseLevel(const unsigned char* sample, size_t len) const;
+    std::string entryHeader(unsigned char prop, Mask& mask) const;
+    std::string payloadKey(unsigned char prop, const std::filesystem::path& path, const unsigned char* data, size_t len) const;
+    std::string payloadKey(unsigned char prop, const std::filesystem::path& path, const std::string& digest) const;
+    unsigned int storedPayload(const std::string& key) const;
+    void writeReference(const std::filesystem::path& path, size_t rawSize, unsigned int source);
+    std::pair<size_t, unsigned char*> encrypt_data(const unsigned char* in, size_t len, unsigned int kix, const unsigned char* salt = nullptr, const unsigned char* key = nullptr) const;
+    std::pair<size_t, unsigned char*> encrypt_gcm(const unsigned char* in, size_t len, unsigned int kix, const unsigned char* salt = nullptr, const unsigned char* key = nullptr) const;
+    std::pair<size_t, unsigned char*> encodeFrame(const unsigned char* in, size_t len, unsigned char prop, unsigned int kix, const unsigned char* salt, const unsigned char* key, int level, Mask& mask) const;
+    std::string passwordOf(unsigned int kix) const;
+    void entryKey(unsigned int kix, const unsigned char* salt, unsigned char* key) const;
+    unsigned char propOf(const std::filesystem::path& path) const;
+    unsigned int kixOf(const std::filesystem::path& path) const;
+    bool streamPath(const std::filesystem::path& path);
+    bool packPath(const std::filesystem::path& path, unsigned int fsid, PackedEntry& entry) const;
+    void writeEntry(const std::filesystem::path& path, PackedEntry& entry);
+    void addToBlock(PackedEntry& entry);
+    void closeBlock();
+    void runParallel();
+    void trainDictionary();
+    std::vector<unsigned char> buildPathIndex() const;
+    void loadArchive();
+    std::pair<unsigned long long, unsigned long long> statOf(const std::filesystem::path& path) const;
+    unsigned int updatePath(const std::filesystem::path& path, unsigned int old, bool isRoot);
+    void updateRoot(const std::filesystem::path& path);
 public:
     void AddPath(std::filesystem::path path, unsigned int fsid);
     void AddProp(std::filesystem::path path, unsigned char prop);
@@ -36,7 +123,21 @@ public:
     void SetKey(unsigned int key, std::string val);
     void SetKix(std::filesystem::path path, unsigned int kix);
     void SetExecPri(std::filesystem::path path, unsigned int pri);
+    void SetThreads(unsigned int count);
+    void SetBufferSize(size_t size);
+    void SetKeyScheme(unsigned char scheme);
+    void SetPathIndex(bool enable);
+    void SetSolidSize(size_t size);
+    void SetDictSize(size_t size);
+    void SetLevel(int level);
+    void SetLongMatching(bool enable);
+    void SetWindowLog(int log);
+    void SetZstdWorkers(int count);
+    void SetAdaptive(bool enable);
+    void SetDedup(bool enable);
+    void SetFrameSize(size_t size);
     void AddRoutine(std::filesystem::path path, bool isRoot = true);
-    EArchive(std::string out);
+    void UpdateRoutine(std::filesystem::path path);
+    EArchive(std::string out, bool update = false);
     ~EArchive();
 };
\ No newline at end of file
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class DArchive;
+
+// Serves the archive read-only at `mountpoint` in the foreground until it
+// is unmounted; `options` go to libfuse as they are. Returns libfuse's
+// exit status.
+int MountArchive(DArchive& arch, const std::string& mountpoint, const std::vector<std::string>& options);
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <filesystem>
+
+class MappedFile {
+private:
+    const unsigned char* ptr;
+    size_t len;
+#ifdef _WIN32
+    void* file;
+    void* mapping;
+#else
+    int fd;
+#endif
+public:
+    bool open(const std::filesystem::path& path);
+    void close();
+    bool isMapped() const;
+    const unsigned char* data() const;
+    size_t size() const;
+    MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+};
@@ -3,27 +3,110 @@
 #include "bitio.hpp"
 
 #include <utility>
+#include <vector>
 
-struct TreapNode {
-    unsigned char val;
-    unsigned int pri, siz;
-    TreapNode *ls, *rs;
+// The byte values not yet placed in a mask permutation, as a 256-bit set
+// on the stack; ranks count the remaining values in ascending order.
+class MaskRankSet {
+private:
+    unsigned long long words[4];
+    unsigned char counts[4];
+
+public:
+    unsigned char access_and_delete(unsigned int rank);
+    MaskRankSet();
+};
 
-    void update();
-    TreapNode(unsigned char val);
+class SplitMix64 {
+private:
+    unsigned long long state;
+public:
+    explicit SplitMix64(unsigned long long seed) : state(seed) {}
+    unsigned long long next() {
+        unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
 };
 
-class MaskTreap {
+class Xoshiro256pp {
 private:
-    TreapNode* root;
+    unsigned long long s[4];
 
-    unsigned int get_size(TreapNode* u);
-    std::pair<TreapNode*, TreapNode*> split(TreapNode* u, unsigned int rank);
-    TreapNode* merge(TreapNode* l, TreapNode* r);
+    static inline unsigned long long rotl(const unsigned long long x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
 
 public:
-    unsigned char access_and_delete(unsigned int rank);
-    MaskTreap();
+    explicit Xoshiro256pp(unsigned long long seed) {
+        SplitMix64 sm64(seed);
+        for (int i = 0; i < 4; i++) {
+            s[i] = sm64.next();
+        }
+    }
+
+    unsigned long long next() {
+        const unsigned long long result = rotl(s[0] + s[3], 23) + s[0];
+
+        const unsigned long long t = s[1] << 17;
+
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+
+        s[2] ^= t;
+
+        s[3] = rotl(s[3], 45);
+
+        return result;
+    }
+};
+
+class Xoshiro256ppByteStream {
+private:
+    Xoshiro256pp rng;
+    unsigned char buffer[8];
+    int buffer_index;
+
+    void refill_buffer() {
+        unsigned long long val = rng.next();
+        for (int i = 0; i < 8; ++i) {
+            buffer[i] = ((val >> (56 - 8 * i)) & 0xFF);
+        }
+        buffer_index = 0;
+    }
+
+public:
+    explicit Xoshiro256ppByteStream(unsigned long long seed) : rng(seed), buffer_index(8) {}
+
+    unsigned char next_byte() {
+        if (buffer_index >= 8) {
+            refill_buffer();
+        }
+        return buffer[buffer_index++];
+    }
+
+    // Same bytes as len calls to next_byte().
+    void fill(unsigned char* out, size_t len) {
+        while (len && buffer_index < 8) {
+            *out++ = buffer[buffer_index++];
+            len--;
+        }
+        for (; len >= 8; len -= 8, out += 8) {
+            unsigned long long val = rng.next();
+            out[0] = val >> 56;
+            out[1] = val >> 48;
+            out[2] = val >> 40;
+            out[3] = val >> 32;
+            out[4] = val >> 24;
+            out[5] = val >> 16;
+            out[6] = val >> 8;
+            out[7] = val;
+        }
+        while (len--) *out++ = next_byte();
+    }
 };
 
 class Mask {
@@ -34,6 +117,41 @@ public:
     void write(BitOutput& os);
     void versionId(int version);
     void read(BitInput& is);
-    void mask(void* buf, size_t len);
-    void unmask(void* buf, size_t len);
+    unsigned long long seed() const;
+    void mask(void* buf, size_t len, int rounds = 1);
+    void unmask(void* buf, size_t len, int rounds = 1);
+};
+
+// One mask() or unmask() pass carried across consecutive windows of a
+// payload. Every stage of the transform only looks backwards, so feeding
+// a payload in pieces gives the same bytes as a single call; the Fenwick
+// stage keeps the last encoded byte of each node size. Whole blocks go
+// through the kernels of mask_simd.hpp, the rest byte by byte.
+class MaskStream {
+private:
+    const Mask& m;
+    bool reverse;
+    unsigned long long pos;
+    unsigned char sum, acc;
+    unsigned char levels[64];
+    Xoshiro256ppByteStream bs;
+
+    template<int version> void forward(unsigned char* buffer, size_t len);
+    template<int version> void backward(unsigned char* buffer, size_t len);
+    template<int version> void forwardBlocks(unsigned char* buffer, size_t len);
+    template<int version> void backwardBlocks(unsigned char* buffer, size_t len);
+    template<int version> void process(unsigned char* buffer, size_t len);
+public:
+    void feed(void* buf, size_t len);
+    MaskStream(const Mask& mask, bool reverse);
+};
+
+// Repeated mask() or unmask() passes fused into one walk over the data:
+// each tile goes through every round while it is still in cache.
+class MaskChain {
+private:
+    std::vector<MaskStream> rounds;
+public:
+    void feed(void* buf, size_t len);
+    MaskChain(const Mask& mask, bool reverse, int rounds);
 };
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+// MaskStream hands whole blocks of MASK_BLOCK bytes, aligned to the stream
+// position, to these kernels, at most MASK_TILE bytes at a time.
+const size_t MASK_BLOCK = 32;
+const size_t MASK_TILE = 4096;
+
+// Vector kernels behind MaskStream. One table is picked at startup from
+// the CPU features; every table produces the same bytes.
+//
+// fenwickEncode/fenwickDecode run the Fenwick stage over `blocks` blocks
+// starting at stream position `pos`; `levels` holds the last encoded byte
+// of each node size. xorScan and addScan are inclusive prefix scans seeded
+// with `carry`, which receives the last output; `len` is a multiple of
+// MASK_BLOCK.
+struct MaskKernels {
+    const char* name;
+    void (*fenwickEncode)(unsigned char* buf, size_t blocks, unsigned long long pos, unsigned char* levels);
+    void (*fenwickDecode)(unsigned char* buf, size_t blocks, unsigned long long pos, unsigned char* levels);
+    void (*xorScan)(const unsigned char* in, unsigned char* out, size_t len, unsigned char& carry);
+    void (*addScan)(unsigned char* buf, size_t len, unsigned char& carry);
+};
+
+const MaskKernels& maskKernels();
+
+// Forces the kernels by name ("scalar", "sse2", "avx2"); returns false if
+// this CPU can't run them. Meant for benchmarks.
+bool selectMaskKernels(const char* name);
+
+inline int lowest_bit(unsigned long long k) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(k);
+#else
+    int t = 0;
+    while (!((k >> t) & 1)) t++;
+    return t;
+#endif
+}
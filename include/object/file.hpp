@@ -6,10 +6,10 @@
 class File : public Object {
 public:
     bool isClosed;
-    std::shared_ptr<std::fstream> fs;
+    std::shared_ptr<std::iostream> fs;
 public:
     File(std::string name, std::string mode);
-    File(std::shared_ptr<std::fstream> fs);
+    File(std::shared_ptr<std::iostream> fs);
     std::shared_ptr<Object> make_copy() override;
     std::string toString() override;
     void close();
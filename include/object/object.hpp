@@ -20,7 +20,7 @@ public:
         Segment, // Same as std::deque
         Iterator, // Standard Iterator
         ByteArray, // ByteArray (vector<Byte>)
-        File, // C++ File Stream (std::fstream)
+        File, // C++ Stream (std::fstream, or an archive entry)
         Native, // Native Type
         Reference, // Remote Reference
         Mark // mark a class or enumerate
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// Section::PATHS maps the hash of an archive path ("root/dir/name") to its
+// fsid with open addressing: [u32 slots][slots x (u64 hash, u32 fsid)],
+// where slots is a power of two and empty slots hold 0xffffffff.
+namespace PathIndex {
+    unsigned long long hash(const std::string& path);
+    std::vector<unsigned char> build(const std::vector<std::pair<std::string, unsigned int>>& paths);
+    bool valid(const std::vector<unsigned char>& table);
+    unsigned int find(const std::vector<unsigned char>& table, const std::string& path);
+}
@@ -2,5 +2,4 @@
 
 #include <random>
 
-extern std::random_device gRD;
-extern std::mt19937 gRnd;
\ No newline at end of file
+extern thread_local std::random_device gRD;
\ No newline at end of file
@@ -1,199 +1,137 @@
 #include "mask.hpp"
+#include "mask_simd.hpp"
 #include "random_src.hpp"
 
-std::random_device gRD;
-std::mt19937 gRnd(gRD());
+#include <algorithm>
 
-void BitOutput::write(unsigned short adata, unsigned char len) {
-    while (len + bufferLength >= 8) {
-        unsigned char freeLength = 8 - bufferLength;
-        unsigned short mask = (((1 << freeLength) - 1) << (len - freeLength));
-        data |= ((adata & mask) >> (len - freeLength));
-        os.write((const char*) &data, 1);
-        data = 0;
-        bufferLength = 0;
-        len -= freeLength;
-    }
-    if (len) {
-        unsigned char freeLength = 8 - bufferLength;
-        unsigned short mask = (1 << len) - 1;
-        data |= ((adata & mask) << (freeLength - len));
-        bufferLength += len;
-    }
-}
+thread_local std::random_device gRD;
+
+BitOutput::BitOutput(unsigned char* out, size_t cap) : out(out), cap(cap), pos(0), os(nullptr), word(0), bits(0) {}
 
-BitOutput::BitOutput(std::ofstream& os) : os(os), data(0), bufferLength(0) {}
+BitOutput::BitOutput(std::ostream& os) : out(chunk), cap(sizeof(chunk)), pos(0), os(&os), word(0), bits(0) {}
 
 BitOutput::~BitOutput() {
-    if (bufferLength) os.write((const char*) &data, 1);
+    finish();
 }
 
-unsigned short BitInput::read(unsigned char len) {
-    unsigned short res = 0;
-    if (len && !bufferLength) {
-        is.read((char*) &data, 1);
-        bufferLength = 8;
+void BitOutput::put(unsigned char byte) {
+    if (pos == cap && os) {
+        os->write((const char*) chunk, pos);
+        pos = 0;
     }
-    while (len && bufferLength <= len) {
-        unsigned short mask = (1 << bufferLength) - 1;
-        res <<= bufferLength;
-        res |= (data & mask);
-        len -= bufferLength;
-        if (len) {
-            is.read((char*) &data, 1);
-            bufferLength = 8;
-        }
-        else bufferLength = 0;
-    }
-    if (len) {
-        unsigned short mask = (((1 << len) - 1) << (bufferLength - len));
-        res <<= len;
-        res |= ((data & mask) >> (bufferLength - len));
-        bufferLength -= len;
-    }
-    return res;
+    if (pos < cap) out[pos++] = byte;
 }
 
-BitInput::BitInput(std::ifstream& is) : is(is), data(0), bufferLength(0) {}
-
-void TreapNode::update() {
-    siz = 1 + (ls ? ls->siz : 0) + (rs ? rs->siz : 0);
+void BitOutput::drain() {
+    for (; bits >= 8; bits -= 8, word <<= 8) put(word >> 56);
 }
 
-TreapNode::TreapNode(unsigned char val) : val(val), pri(gRnd()), siz(1), ls(nullptr), rs(nullptr) {}
-
-unsigned int MaskTreap::get_size(TreapNode* u) {
-    return u ? u->siz : 0;
+void BitOutput::write(unsigned short adata, unsigned char len) {
+    if (!len) return;
+    if (bits + len > 64) drain();
+    unsigned long long val = adata & ((1u << len) - 1);
+    word |= val << (64 - bits - len);
+    bits += len;
 }
 
-std::pair<TreapNode*, TreapNode*> MaskTreap::split(TreapNode* u, unsigned int rank) {
-    if (rank == 0) return {nullptr, u};
-    if (rank == u->siz) return {u, nullptr};
-    if (rank <= get_size(u->ls)) {
-        auto[a, b] = split(u->ls, rank);
-        u->ls = b;
-        u->update();
-        return {a, u};
+// Pads the last byte with zero bits; returns the bytes packed into the
+// span, or 0 for a stream once everything is written out.
+size_t BitOutput::finish() {
+    drain();
+    if (bits) {
+        put(word >> 56);
+        word = 0;
+        bits = 0;
     }
-    else {
-        auto[a, b] = split(u->rs, rank - get_size(u->ls) - 1);
-        u->rs = a;
-        u->update();
-        return {u, b};
+    if (os && pos) {
+        os->write((const char*) chunk, pos);
+        pos = 0;
     }
+    return pos;
 }
 
-TreapNode* MaskTreap::merge(TreapNode* l, TreapNode* r) {
-    if (!l && !r) return nullptr;
-    if (!l) return r;
-    if (!r) return l;
-    if (l->pri > r->pri) {
-        l->rs = merge(l->rs, r);
-        l->update();
-        return l;
-    }
-    else {
-        r->ls = merge(l, r->ls);
-        r->update();
-        return r;
-    }
-}
+BitInput::BitInput(const unsigned char* in, size_t len) : in(in), len(len), pos(0), is(nullptr), word(0), bits(0) {}
 
-unsigned char MaskTreap::access_and_delete(unsigned int rank) {
-    auto[a, bc] = split(root, rank);
-    auto[b, c] = split(bc, 1);
-    root = merge(a, c);
-    unsigned char res = b->val;
-    delete b;
-    return res;
-}
+BitInput::BitInput(std::istream& is) : in(chunk), len(0), pos(0), is(&is), word(0), bits(0) {}
 
-MaskTreap::MaskTreap() {
-    root = nullptr;
-    for (unsigned short i = 0; i < 256; i++) {
-        root = merge(root, new TreapNode(i));
+// Tops the word up with whole bytes. From a span that is one big-endian
+// 64-bit load when 8 bytes are left; a stream only yields the bytes the
+// pending read still needs, so it is never read ahead.
+void BitInput::refill(unsigned char need) {
+    if (is && pos == len) {
+        len = (need - bits + 7) >> 3;
+        pos = 0;
+        is->read((char*) chunk, len);
+        len = is->gcount();
     }
-}
-
-class SplitMix64 {
-private:
-    unsigned long long state;
-public:
-    explicit SplitMix64(unsigned long long seed) : state(seed) {}
-    unsigned long long next() {
-        unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
-        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
-        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
-        return z ^ (z >> 31);
+    size_t room = (64 - bits) >> 3;
+    if (len - pos >= 8) {
+        unsigned long long val = 0;
+        for (int i = 0; i < 8; i++) val = (val << 8) | in[pos + i];
+        unsigned int keep = bits + (room << 3);
+        val >>= bits;
+        if (keep < 64) val &= ~(~0ULL >> keep);
+        word |= val;
+        pos += room;
+        bits += room << 3;
+        return;
     }
-};
-
-class Xoshiro256pp {
-private:
-    unsigned long long s[4];
-
-    static inline unsigned long long rotl(const unsigned long long x, int k) {
-        return (x << k) | (x >> (64 - k));
-    }
-
-public:
-    explicit Xoshiro256pp(unsigned long long seed) {
-        SplitMix64 sm64(seed);
-        for (int i = 0; i < 4; i++) {
-            s[i] = sm64.next();
-        }
-    }
-
-    unsigned long long next() {
-        const unsigned long long result = rotl(s[0] + s[3], 23) + s[0];
-
-        const unsigned long long t = s[1] << 17;
-
-        s[2] ^= s[0];
-        s[3] ^= s[1];
-        s[1] ^= s[2];
-        s[0] ^= s[3];
-
-        s[2] ^= t;
-
-        s[3] = rotl(s[3], 45);
-
-        return result;
-    }
-};
-
-class Xoshiro256ppByteStream {
-private:
-    Xoshiro256pp rng;
-    unsigned char buffer[8];
-    int buffer_index;
-
-    void refill_buffer() {
-        unsigned long long val = rng.next();
-        for (int i = 0; i < 8; ++i) {
-            buffer[i] = ((val >> (56 - 8 * i)) & 0xFF);
-        }
-        buffer_index = 0;
+    for (; room && pos < len; room--, bits += 8) {
+        word |= ((unsigned long long) in[pos++]) << (56 - bits);
     }
+}
 
-public:
-    explicit Xoshiro256ppByteStream(unsigned long long seed) : rng(seed), buffer_index(8) {}
+unsigned short BitInput::read(unsigned char len) {
+    if (!len) return 0;
+    if (bits < len) refill(len);
+    // Past the end of the data the missing bits read as zero.
+    unsigned short res = word >> (64 - len);
+    word <<= len;
+    bits = bits > len ? bits - len : 0;
+    return res;
+}
 
-    unsigned char next_byte() {
-        if (buffer_index >= 8) {
-            refill_buffer();
+// Position of the rank-th set bit of every byte value.
+static const struct SelectInByte {
+    unsigned char pos[256][8];
+    SelectInByte() : pos{} {
+        for (int v = 0; v < 256; v++) {
+            for (int b = 0, r = 0; b < 8; b++) {
+                if ((v >> b) & 1) pos[v][r++] = b;
+            }
         }
-        return buffer[buffer_index++];
     }
-};
+} selectInByte;
+
+MaskRankSet::MaskRankSet() : words{~0ULL, ~0ULL, ~0ULL, ~0ULL}, counts{64, 64, 64, 64} {}
+
+unsigned char MaskRankSet::access_and_delete(unsigned int rank) {
+    int w = 0;
+    for (; w < 3 && rank >= counts[w]; w++) rank -= counts[w];
+
+    // Broadword select: the running byte sums of the word locate the byte
+    // holding the bit, a table finds it inside that byte.
+    const unsigned long long L8 = 0x0101010101010101ULL, H8 = 0x8080808080808080ULL;
+    unsigned long long x = words[w];
+    unsigned long long s = x - ((x >> 1) & 0x5555555555555555ULL);
+    s = (s & 0x3333333333333333ULL) + ((s >> 2) & 0x3333333333333333ULL);
+    s = ((s + (s >> 4)) & 0x0F0F0F0F0F0F0F0FULL) * L8;
+    unsigned long long below = ((((rank * L8) | H8) - s) & H8) >> 7;
+    int place = ((below * L8) >> 56) << 3;
+    rank -= ((s << 8) >> place) & 0xFF;
+    int b = place + selectInByte.pos[(x >> place) & 0xFF][rank];
+    words[w] &= ~(1ULL << b);
+    counts[w]--;
+    return (w << 6) | b;
+}
 
 void Mask::write(BitOutput& os) {
     version = 2;
-    MaskTreap treap;
+    MaskRankSet ranks;
     unsigned char limit = 128, len = 8;
     for (unsigned char i = 0, ci = 0; i < 255; i++, ci++) {
         unsigned short ord = gRD() % (256 - i);
-        unsigned char ch = treap.access_and_delete(ord);
+        unsigned char ch = ranks.access_and_delete(ord);
         mapping[i] = ch;
         rmapping[ch] = i;
         if (ci == limit) {
@@ -203,13 +141,13 @@ void Mask::write(BitOutput& os) {
         }
         os.write(ord, len);
     }
-    mapping[255] = treap.access_and_delete(0);
+    mapping[255] = ranks.access_and_delete(0);
     rmapping[mapping[255]] = 255;
 }
 
 void Mask::read(BitInput& is) {
     version = 0;
-    MaskTreap treap;
+    MaskRankSet ranks;
     unsigned char limit = 128, len = 8;
     for (unsigned char i = 0, ci = 0; i < 255; i++, ci++) {
         if (ci == limit) {
@@ -218,89 +156,202 @@ void Mask::read(BitInput& is) {
             limit >>= 1;
         }
         unsigned short ord = is.read(len);
-        unsigned char ch = treap.access_and_delete(ord);
+        // A damaged header must not rank past the values left.
+        if (ord >= 256 - i) ord = 255 - i;
+        unsigned char ch = ranks.access_and_delete(ord);
         mapping[i] = ch;
         rmapping[ch] = i;
     }
-    mapping[255] = treap.access_and_delete(0);
+    mapping[255] = ranks.access_and_delete(0);
     rmapping[mapping[255]] = 255;
 }
 
-void Mask::mask(void* buf, size_t len) {
-    unsigned char* buffer = (unsigned char*) buf;
+unsigned long long Mask::seed() const {
+    unsigned long long seed = 0;
+    for (int i = 0; i <= 7; i++) {
+        seed |= (((unsigned long long) mapping[i << 2]) << (i << 3));
+    }
+    return seed;
+}
+
+void Mask::mask(void* buf, size_t len, int rounds) {
+    MaskChain(*this, false, rounds).feed(buf, len);
+}
+
+void Mask::unmask(void* buf, size_t len, int rounds) {
+    MaskChain(*this, true, rounds).feed(buf, len);
+}
+
+MaskStream::MaskStream(const Mask& mask, bool reverse) : m(mask), reverse(reverse), pos(0), sum(0), acc(10), levels{}, bs(mask.seed()) {}
+
+// Version 1 adds 101^i to the i-th byte, which repeats every 64 bytes;
+// one extra block lets a block start at any phase.
+static const struct E101Table {
+    unsigned char v[64 + MASK_BLOCK];
+    E101Table() {
+        unsigned char e = 1;
+        for (size_t i = 0; i < sizeof(v); i++, e *= 101) v[i] = e;
+    }
+} e101;
+
+template<int version>
+void MaskStream::forward(unsigned char* buffer, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char x = buffer[i];
+        if (version < 2) {
+            sum += x;
+            x = m.mapping[sum];
+        }
+        if (version == 1) {
+            x += e101.v[pos & 63];
+        }
+        else if (version == 2) {
+            x += bs.next_byte();
+        }
+        if (version >= 2) {
+            x = m.mapping[(x + acc) & 0xFF];
+            acc ^= x;
+            x = m.mapping[x];
+        }
+        int t = lowest_bit(++pos);
+        for (int l = 0; l < t; l++) x ^= levels[l];
+        levels[t] = x;
+        buffer[i] = x;
+    }
+}
+
+template<int version>
+void MaskStream::backward(unsigned char* buffer, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        unsigned char x = buffer[i];
+        int t = lowest_bit(pos + 1);
+        for (int l = 0; l < t; l++) x ^= levels[l];
+        levels[t] = buffer[i];
+        if (version >= 2) {
+            unsigned char y = m.rmapping[x];
+            x = (m.rmapping[y] - acc) & 0xFF;
+            acc ^= y;
+        }
+        if (version == 1) {
+            x -= e101.v[pos & 63];
+        }
+        else if (version == 2) {
+            x -= bs.next_byte();
+        }
+        if (version < 2) {
+            x = m.rmapping[x];
+            unsigned char d = x - sum;
+            sum = x;
+            x = d;
+        }
+        pos++;
+        buffer[i] = x;
+    }
+}
+
+// The stages run as separate passes over a tile: the scans and the
+// Fenwick stage in vector kernels, the table lookups as independent loads.
+// Only the acc chain of mask() for version 2 stays byte-serial.
+template<int version>
+void MaskStream::forwardBlocks(unsigned char* buffer, size_t len) {
+    const MaskKernels& k = maskKernels();
     if (version < 2) {
-        for (long long i = 1; i < len; i++) buffer[i] += buffer[i - 1];
-        for (long long i = 0; i < len; i++) buffer[i] = mapping[buffer[i]];
+        k.addScan(buffer, len, sum);
+        for (size_t i = 0; i < len; i++) buffer[i] = m.mapping[buffer[i]];
     }
     if (version == 1) {
-        unsigned short e = 1;
-        for (long long i = 0; i < len; i++) {
-            buffer[i] += e;
-            e = ((e * 101) & 255);
+        for (size_t i = 0; i < len; i += MASK_BLOCK) {
+            const unsigned char* e = e101.v + ((pos + i) & 63);
+            for (size_t j = 0; j < MASK_BLOCK; j++) buffer[i + j] += e[j];
         }
     }
     else if (version == 2) {
-        unsigned long long seed = 0;
-        for (int i = 0; i <= 7; i++) {
-            seed |= (((unsigned long long) mapping[i << 2]) << (i << 3));
-        }
-        Xoshiro256ppByteStream bs(seed);
-        for (long long i = 0; i < len; i++) {
-            buffer[i] += bs.next_byte();
-        }
+        unsigned char noise[MASK_TILE];
+        bs.fill(noise, len);
+        for (size_t i = 0; i < len; i++) buffer[i] += noise[i];
     }
     if (version >= 2) {
-        unsigned char acc = 10;
-        for (int i = 0; i < len; i++) {
-            buffer[i] = mapping[(buffer[i] + acc) & 0xFF];
-            acc ^= buffer[i];
+        unsigned char a = acc;
+        for (size_t i = 0; i < len; i++) {
+            unsigned char x = m.mapping[(buffer[i] + a) & 0xFF];
+            a ^= x;
+            buffer[i] = m.mapping[x];
         }
-        for (long long i = 0; i < len; i++) buffer[i] = mapping[buffer[i]];
-    }
-    for (long long i = 1; i < len; i++) buffer[i] ^= buffer[i - 1];
-    for (long long i = len - 1; i > 0; i--) {
-        long long lb = ((i + 1) & -(i + 1));
-        if (lb != i + 1) buffer[i] ^= buffer[i - lb];
+        acc = a;
     }
+    k.fenwickEncode(buffer, len / MASK_BLOCK, pos, levels);
+    pos += len;
 }
 
-void Mask::unmask(void* buf, size_t len) {
-    unsigned char* buffer = (unsigned char*) buf;
-    for (long long i = 1; i < len; i++) {
-        long long lb = ((i + 1) & -(i + 1));
-        if (lb != i + 1) buffer[i] ^= buffer[i - lb];
-    }
-    for (long long i = len - 1; i > 0; i--) buffer[i] ^= buffer[i - 1];
+template<int version>
+void MaskStream::backwardBlocks(unsigned char* buffer, size_t len) {
+    if (!len) return;
+    const MaskKernels& k = maskKernels();
+    k.fenwickDecode(buffer, len / MASK_BLOCK, pos, levels);
     if (version >= 2) {
-        for (long long i = 0; i < len; i++) buffer[i] = rmapping[buffer[i]];
-        unsigned char acc = 10;
-        for (int i = 0; i < len; i++) {
+        unsigned char chain[MASK_TILE], noise[MASK_TILE];
+        for (size_t i = 0; i < len; i++) buffer[i] = m.rmapping[buffer[i]];
+        // chain[i] ^ y is the acc in effect before byte i.
+        k.xorScan(buffer, chain, len, acc);
+        if (version == 2) bs.fill(noise, len);
+        for (size_t i = 0; i < len; i++) {
             unsigned char y = buffer[i];
-            unsigned char x = (rmapping[buffer[i]] - acc) & 0xFF;
-            buffer[i] = x;
-            acc ^= y;
+            buffer[i] = m.rmapping[y] - (chain[i] ^ y) - (version == 2 ? noise[i] : 0);
         }
     }
     if (version == 1) {
-        unsigned short e = 1;
-        for (long long i = 0; i < len; i++) {
-            buffer[i] -= e;
-            e = ((e * 101) & 255);
+        for (size_t i = 0; i < len; i += MASK_BLOCK) {
+            const unsigned char* e = e101.v + ((pos + i) & 63);
+            for (size_t j = 0; j < MASK_BLOCK; j++) buffer[i + j] -= e[j];
         }
     }
-    else if (version == 2) {
-        unsigned long long seed = 0;
-        for (int i = 0; i <= 7; i++) {
-            seed |= (((unsigned long long) mapping[i << 2]) << (i << 3));
+    if (version < 2) {
+        unsigned char x[MASK_TILE];
+        for (size_t i = 0; i < len; i++) x[i] = m.rmapping[buffer[i]];
+        buffer[0] = x[0] - sum;
+        for (size_t i = 1; i < len; i++) buffer[i] = x[i] - x[i - 1];
+        sum = x[len - 1];
+    }
+    pos += len;
+}
+
+template<int version>
+void MaskStream::process(unsigned char* buffer, size_t len) {
+    while (len) {
+        size_t n = MASK_BLOCK - pos % MASK_BLOCK;
+        if (n == MASK_BLOCK && len >= MASK_BLOCK) {
+            n = std::min(len, MASK_TILE) / MASK_BLOCK * MASK_BLOCK;
+            reverse ? backwardBlocks<version>(buffer, n) : forwardBlocks<version>(buffer, n);
         }
-        Xoshiro256ppByteStream bs(seed);
-        for (long long i = 0; i < len; i++) {
-            buffer[i] -= bs.next_byte();
+        else {
+            n = std::min(n, len);
+            reverse ? backward<version>(buffer, n) : forward<version>(buffer, n);
         }
+        buffer += n;
+        len -= n;
     }
-    if (version < 2) {
-        for (long long i = 0; i < len; i++) buffer[i] = rmapping[buffer[i]];
-        for (long long i = len - 1; i > 0; i--) buffer[i] -= buffer[i - 1];
+}
+
+void MaskStream::feed(void* buf, size_t len) {
+    unsigned char* buffer = (unsigned char*) buf;
+    switch (m.version) {
+    case 0: process<0>(buffer, len); break;
+    case 1: process<1>(buffer, len); break;
+    case 2: process<2>(buffer, len); break;
+    }
+}
+
+MaskChain::MaskChain(const Mask& mask, bool reverse, int count) {
+    for (int i = 0; i < count; i++) rounds.emplace_back(mask, reverse);
+}
+
+void MaskChain::feed(void* buf, size_t len) {
+    unsigned char* buffer = (unsigned char*) buf;
+    while (len) {
+        size_t n = std::min(len, MASK_TILE);
+        for (auto& round : rounds) round.feed(buffer, n);
+        buffer += n;
+        len -= n;
     }
 }
 
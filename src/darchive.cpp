@@ -2,21 +2,29 @@
 #include "conf.hpp"
 #include "mask.hpp"
 #include "platform.hpp"
+#include "bytes.hpp"
+#include "path_index.hpp"
 #include "mpcc_script.hpp"
 #include <zstd.h>
 #include <cryptopp/cryptlib.h>
 #include <cryptopp/aes.h>
 #include <cryptopp/filters.h>
 #include <cryptopp/modes.h>
+#include <cryptopp/gcm.h>
 #include <cryptopp/sha.h>
 #include <cryptopp/pwdbased.h>
 #include <cryptopp/osrng.h>
 #include <cryptopp/hex.h>
 #include <cryptopp/secblock.h>
+#include <cryptopp/hkdf.h>
 #include <curl/curl.h>
 #include <cstring>
 #include <iostream>
 #include <stdlib.h>
+#include <thread>
+#include <condition_variable>
+#include <memory>
+#include <algorithm>
 
 #include <exception>
 
@@ -100,6 +108,21 @@ char* get_system_proxy_for_curl() {
 }
 
 
+// Each thread keeps one decompression context for every archive it reads;
+// threadDCtx() resets it and attaches this archive's dictionary.
+struct DCtxHolder {
+    ZSTD_DCtx* ctx = ZSTD_createDCtx();
+    ~DCtxHolder() { ZSTD_freeDCtx(ctx); }
+};
+
+ZSTD_DCtx_s* DArchive::threadDCtx() {
+    thread_local DCtxHolder holder;
+    ZSTD_DCtx_reset(holder.ctx, ZSTD_reset_session_and_parameters);
+    ZSTD_DCtx_setParameter(holder.ctx, ZSTD_d_windowLogMax, ZSTD_dParam_getBounds(ZSTD_d_windowLogMax).upperBound);
+    if (ddict) ZSTD_DCtx_refDDict(holder.ctx, ddict);
+    return holder.ctx;
+}
+
 std::pair<size_t, unsigned char*> DArchive::decompress_data(const unsigned char* in, size_t len) {
     size_t decompressBound = ZSTD_getFrameContentSize(in, len);
     if (decompressBound == ZSTD_CONTENTSIZE_ERROR) {
@@ -107,7 +130,7 @@ std::pair<size_t, unsigned char*> DArchive::decompress_data(const unsigned char*
     }
     unsigned char* out = new unsigned char[decompressBound];
 
-    size_t actualSize = ZSTD_decompress(out, decompressBound, in, len);
+    size_t actualSize = ZSTD_decompressDCtx(threadDCtx(), out, decompressBound, in, len);
     if (ZSTD_isError(actualSize)) {
         delete[] out;
         throw DArchiveException("Decompression failed: " + std::string(ZSTD_getErrorName(actualSize)));
@@ -118,6 +141,115 @@ std::pair<size_t, unsigned char*> DArchive::decompress_data(const unsigned char*
 
 using namespace CryptoPP;
 
+static void derive_key(const std::string& password, const byte* salt, byte* key, size_t len) {
+    PKCS5_PBKDF2_HMAC<SHA256> pbkdf;
+    pbkdf.DeriveKey(
+        key, len,
+        0,
+        (const byte*) password.data(), password.size(),
+        salt, SALT_SIZE,
+        PBKDF2_ITERATIONS
+    );
+}
+
+std::string DArchive::passwordOf(unsigned int kix) {
+    std::lock_guard<std::recursive_mutex> lk(keyLock);
+    if (keys.find(kix) != keys.end()) {
+        return keys[kix];
+    }
+    auto& missing = missingPassword ? missingPassword : onMissingPassword;
+    if (!missing || !missing(kix)) {
+        throw DArchiveException("Missing password for key index: " + std::to_string(kix));
+    }
+    return keys[kix];
+}
+
+// Entries of a derived-key archive share one PBKDF2 run per key index; the
+// master key is cached together with the password it came from, so a
+// password replaced after a retry derives a fresh one. Other keys are
+// cached by salt the same way.
+void DArchive::entryKey(unsigned int kix, const std::string& password, const unsigned char* salt, unsigned char* key) {
+    auto scheme = keySchemes.find(kix);
+    if (scheme == keySchemes.end() || !(scheme->second.first & KeyScheme::DERIVED)) {
+        std::string id = std::to_string(kix) + ':' + std::string((const char*) salt, SALT_SIZE);
+        {
+            std::lock_guard<std::recursive_mutex> lk(keyLock);
+            auto it = saltKeys.find(id);
+            if (it != saltKeys.end() && it->second.first == password) {
+                std::memcpy(key, it->second.second.data(), KEY_SIZE);
+                return;
+            }
+        }
+        derive_key(password, salt, key, KEY_SIZE);
+        std::lock_guard<std::recursive_mutex> lk(keyLock);
+        if (saltKeys.size() >= KEY_CACHE_ENTRIES) saltKeys.clear();
+        saltKeys[id] = {password, std::vector<unsigned char>(key, key + KEY_SIZE)};
+        return;
+    }
+
+    std::vector<unsigned char> master;
+    {
+        std::lock_guard<std::recursive_mutex> lk(keyLock);
+        auto it = masterKeys.find(kix);
+        if (it == masterKeys.end() || it->second.first != password) {
+            std::vector<unsigned char> mkey(MASTER_KEY_SIZE);
+            derive_key(password, scheme->second.second.data(), mkey.data(), mkey.size());
+            masterKeys[kix] = {password, mkey};
+            it = masterKeys.find(kix);
+        }
+        master = it->second.second;
+    }
+
+    HKDF<SHA256> hkdf;
+    hkdf.DeriveKey(key, KEY_SIZE, master.data(), master.size(), salt, SALT_SIZE, (const byte*) ENTRY_KEY_INFO, sizeof(ENTRY_KEY_INFO) - 1);
+}
+
+bool DArchive::retryPassword(unsigned int kix, std::string& password) {
+    std::lock_guard<std::recursive_mutex> lk(keyLock);
+    // Another extraction thread may already have replaced the key.
+    auto& incorrect = incorrectPassword ? incorrectPassword : onIncorrectPassword;
+    if (keys[kix] != password || (incorrect && incorrect(kix))) {
+        password = keys[kix];
+        return true;
+    }
+    return false;
+}
+
+unsigned char DArchive::schemeOf(unsigned int kix) {
+    auto it = keySchemes.find(kix);
+    return it == keySchemes.end() ? 0 : it->second.first;
+}
+
+// GCM entries are [kix][salt][iv][cipher][tag] with kix and salt as
+// associated data; a wrong password fails the tag check.
+std::pair<size_t, unsigned char*> DArchive::decrypt_gcm(const unsigned char* in, size_t len, unsigned int kix) {
+    if (len < 4 + SALT_SIZE + GCM_IV_SIZE + TAG_SIZE) {
+        throw DArchiveException("Invalid encrypted entry.");
+    }
+    const byte* salt = in + 4;
+    const byte* iv = in + SALT_SIZE + 4;
+    const byte* cipherData = in + SALT_SIZE + GCM_IV_SIZE + 4;
+    size_t cipherLen = len - SALT_SIZE - GCM_IV_SIZE - TAG_SIZE - 4;
+
+    std::string password = passwordOf(kix);
+    unsigned char* out = new unsigned char[cipherLen];
+
+    while (true) {
+        SecByteBlock key(KEY_SIZE);
+        entryKey(kix, password, salt, key);
+
+        GCM<AES>::Decryption dec;
+        dec.SetKeyWithIV(key, key.size(), iv, GCM_IV_SIZE);
+        if (dec.DecryptAndVerify(out, cipherData + cipherLen, TAG_SIZE, iv, GCM_IV_SIZE, in, 4 + SALT_SIZE, cipherData, cipherLen)) {
+            return {cipherLen, out};
+        }
+        if (!retryPassword(kix, password)) {
+            delete[] out;
+            throw DArchiveException("Decryption failed: authentication failed.");
+        }
+    }
+}
+
 std::pair<size_t, unsigned char*> DArchive::decrypt_data(const unsigned char* in, size_t len) {
     const byte* salt = in + 4;
     const byte* iv = in + SALT_SIZE + 4;
@@ -129,29 +261,14 @@ std::pair<size_t, unsigned char*> DArchive::decrypt_data(const unsigned char* in
         kix |= ((unsigned int) in[i]) << (i << 3);
     }
 
-    std::string password;
+    if (schemeOf(kix) & KeyScheme::GCM) return decrypt_gcm(in, len, kix);
 
-    if (keys.find(kix) != keys.end()) {
-        password = keys[kix];
-    }
-    else {
-        if (!onMissingPassword(kix)) {
-            throw DArchiveException("Missing password for key index: " + std::to_string(kix));
-        }
-        else password = keys[kix];
-    }
+    std::string password = passwordOf(kix);
 
     while (true) {
         try {
             SecByteBlock key(KEY_SIZE);
-            PKCS5_PBKDF2_HMAC<SHA256> pbkdf;
-            pbkdf.DeriveKey(
-                key, key.size(),
-                0,
-                (const byte*) password.data(), password.size(),
-                salt, SALT_SIZE,
-                PBKDF2_ITERATIONS
-            );
+            entryKey(kix, password, salt, key);
 
             CBC_Mode<AES>::Decryption dec;
             dec.SetKeyWithIV(key, key.size(), iv);
@@ -169,8 +286,7 @@ std::pair<size_t, unsigned char*> DArchive::decrypt_data(const unsigned char* in
             return {dataSize, out};
         }
         catch (const Exception& e) {
-            if (onIncorrectPassword(kix)) password = keys[kix];
-            else throw DArchiveException(std::string("Decryption failed: ") + e.what());
+            if (!retryPassword(kix, password)) throw DArchiveException(std::string("Decryption failed: ") + e.what());
         }
     }
 }
@@ -178,70 +294,305 @@ std::pair<size_t, unsigned char*> DArchive::decrypt_data(const unsigned char* in
 size_t write_data(void* ptr, size_t size, size_t nmemb, void* stream) {
     std::ofstream& out = *reinterpret_cast<std::ofstream*>(stream);
     out.write((char*)ptr, size * nmemb);
-    return size * nmemb;
+    return out ? size * nmemb : 0;
 }
 
-bool DArchive::download(std::string url, std::filesystem::path save) {
-    if (!curlState) {
-        curl_global_init(CURL_GLOBAL_DEFAULT);
+// Fetches NETWORK entries on its own thread while the rest of the archive
+// extracts. Every transfer goes through one multi handle, so connections
+// to the same host are reused, and at most `slots` run at once. Data lands
+// in "<path>.part" and is renamed when complete; a .part left behind by an
+// interrupted run is resumed with a Range request.
+class DownloadPool {
+private:
+    struct Transfer {
+        std::string url;
+        std::filesystem::path path, part;
+        std::ofstream out;
+        curl_off_t resumed = 0;
+    };
+    CURLM* multi;
+    std::thread worker;
+    std::queue<std::pair<std::string, std::filesystem::path>> jobs;
+    std::map<CURL*, std::unique_ptr<Transfer>> running;
+    std::mutex lock;
+    std::condition_variable queued;
+    unsigned int slots;
+    bool stop, abort;
+    std::string error;
+
+    void fail(const std::string& msg) {
+        std::lock_guard<std::mutex> lk(lock);
+        if (error.empty()) error = "Download file failed: " + msg;
     }
-    
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        throw DArchiveException("Download file failed: Unable to initialize CURL.");
+
+    void start(const std::string& url, const std::filesystem::path& path) {
+        auto t = std::make_unique<Transfer>();
+        t->url = url;
+        t->path = path;
+        t->part = path;
+        t->part += ".part";
+        std::error_code ec;
+        auto size = std::filesystem::file_size(toPlatformPath(t->part), ec);
+        if (!ec) t->resumed = size;
+        t->out.open(toPlatformPath(t->part), std::ios::binary | (t->resumed ? std::ios::app : std::ios::trunc));
+        if (!t->out) return fail("Unable to open the output file.");
+
+        CURL* curl = curl_easy_init();
+        if (!curl) return fail("Unable to initialize CURL.");
+        curl_easy_setopt(curl, CURLOPT_PROXY, get_system_proxy_for_curl());
+        curl_easy_setopt(curl, CURLOPT_URL, t->url.c_str());
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &t->out);
+        if (t->resumed) curl_easy_setopt(curl, CURLOPT_RESUME_FROM_LARGE, t->resumed);
+        curl_multi_add_handle(multi, curl);
+        running[curl] = std::move(t);
     }
 
-    std::ofstream out(toPlatformPath(save), std::ios::binary);
-    if (!out) {
-        throw DArchiveException("Download file failed: Unable to open the output file.");
+    void finish(CURL* curl, CURLcode res) {
+        auto t = std::move(running[curl]);
+        running.erase(curl);
+        long code = 0;
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+        curl_multi_remove_handle(multi, curl);
+        curl_easy_cleanup(curl);
+        t->out.close();
+
+        std::error_code ec;
+        // The server can't continue this .part; fetch the whole file again.
+        if (t->resumed && (res == CURLE_RANGE_ERROR || code == 416)) {
+            std::filesystem::remove(toPlatformPath(t->part), ec);
+            return start(t->url, t->path);
+        }
+        if (res != CURLE_OK) return fail(std::string(curl_easy_strerror(res)) + " (" + t->url + ')');
+        std::filesystem::rename(toPlatformPath(t->part), toPlatformPath(t->path), ec);
+        if (ec) fail("Unable to open the output file.");
     }
 
-    char* _p = get_system_proxy_for_curl();
-    curl_easy_setopt(curl, CURLOPT_PROXY, _p);
+    void run() {
+        while (true) {
+            std::vector<std::pair<std::string, std::filesystem::path>> next;
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                if (running.empty()) queued.wait(lk, [&]() { return stop || abort || !jobs.empty(); });
+                if (abort || (stop && jobs.empty() && running.empty())) break;
+                while (!jobs.empty() && running.size() + next.size() < slots) {
+                    next.push_back(jobs.front());
+                    jobs.pop();
+                }
+            }
+            for (auto& [url, path] : next) start(url, path);
+
+            int active, left;
+            curl_multi_perform(multi, &active);
+            while (CURLMsg* msg = curl_multi_info_read(multi, &left)) {
+                if (msg->msg == CURLMSG_DONE) finish(msg->easy_handle, msg->data.result);
+            }
+            if (!running.empty()) curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+        }
+        for (auto& [curl, t] : running) {
+            curl_multi_remove_handle(multi, curl);
+            curl_easy_cleanup(curl);
+        }
+        running.clear();
+    }
 
-    if (!curlState) curlState = true;
+    void wake() {
+        queued.notify_one();
+        curl_multi_wakeup(multi);
+    }
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_data);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &out);
+public:
+    void submit(std::string url, std::filesystem::path path) {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            if (!error.empty()) return;
+            jobs.push({url, path});
+        }
+        wake();
+    }
 
-    CURLcode res = curl_easy_perform(curl);
-    curl_easy_cleanup(curl);
+    // Blocks until every submitted download is on disk, throwing for the
+    // first one that failed. Its .part stays behind for the next attempt.
+    void wait() {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stop = true;
+        }
+        wake();
+        if (worker.joinable()) worker.join();
+        if (!error.empty()) throw DArchiveException(error);
+    }
 
-    out.close();
+    DownloadPool(unsigned int slots) : slots(slots ? slots : 1), stop(false), abort(false) {
+        multi = curl_multi_init();
+        if (!multi) throw DArchiveException("Download file failed: Unable to initialize CURL.");
+        curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, (long) this->slots);
+        worker = std::thread([this]() { run(); });
+    }
 
-    if (res != CURLE_OK) {
-        std::filesystem::remove(toPlatformPath(save));
-        throw DArchiveException("Download file failed: Download failed.");
+    ~DownloadPool() {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            abort = true;
+        }
+        wake();
+        if (worker.joinable()) worker.join();
+        curl_multi_cleanup(multi);
     }
+};
 
-    return true;
+void DArchive::finishDownloads() {
+    if (!downloads) return;
+    auto pool = std::move(downloads);
+    pool->wait();
 }
 
 std::pair<size_t, unsigned char*> DArchive::extractData(unsigned int fsid, unsigned char& prop) {
-    if (fsid >= fileCount) {
+    return extractData(fsid, prop, is);
+}
+
+std::pair<size_t, unsigned char*> DArchive::extractData(unsigned int fsid, unsigned char& prop, std::istream& in) {
+    fsid = payloadOf(fsid);
+    if (!isSolid(fsid)) return decodeEntry(fsid, prop, in);
+
+    const SolidRef& ref = solidRefs[fsid];
+    auto [size, block] = solidBlock(ref.block, in);
+    if (!block) return {0, nullptr};
+    if (ref.offset > size || ref.size > size - ref.offset) {
         good = false;
-        throw DArchiveException("FSID is out of the range.");
+        throw DArchiveException("Solid entry is out of its block.");
     }
+    unsigned char head;
+    readAt(in, fileOffsets[fsid], &head, 1);
+    prop = BitInput(&head, 1).read(7);
 
-    is.seekg(fileOffsets[fsid], std::ios::beg);
-    
-    BitInput ib(is);
-    prop = ib.read(7);
-    Mask mask;
-    mask.read(ib);
+    unsigned char* data = new unsigned char[ref.size];
+    std::memcpy(data, block.get() + ref.offset, ref.size);
+    return {ref.size, data};
+}
+
+unsigned int DArchive::payloadOf(unsigned int fsid) {
+    if (fsid < dedupSources.size() && dedupSources[fsid] != 0xffffffff) return dedupSources[fsid];
+    return fsid;
+}
+
+bool DArchive::isFramed(unsigned int fsid) {
+    return fsid < frameRefs.size() && !frameRefs[fsid].ends.empty();
+}
 
+bool DArchive::isSolid(unsigned int fsid) {
+    return fsid < solidRefs.size() && solidRefs[fsid].block != 0xffffffff;
+}
+
+// Blocks are decoded once and shared; a thread asking for a block another
+// thread is decoding waits for it instead of decoding it again.
+std::pair<size_t, std::shared_ptr<unsigned char[]>> DArchive::solidBlock(unsigned int block, std::istream& in) {
+    std::unique_lock<std::mutex> lk(blockLock);
+    while (true) {
+        for (auto it = blockCache.begin(); it != blockCache.end(); it++) {
+            if (std::get<0>(*it) == block) {
+                blockCache.splice(blockCache.begin(), blockCache, it);
+                return {std::get<1>(*it), std::get<2>(*it)};
+            }
+        }
+        if (!blockLoading.count(block)) break;
+        blockLoaded.wait(lk);
+    }
+    blockLoading.insert(block);
+    lk.unlock();
+
+    unsigned char prop;
+    std::pair<size_t, unsigned char*> decoded;
+    try {
+        decoded = decodeEntry(block, prop, in);
+    }
+    catch (...) {
+        lk.lock();
+        blockLoading.erase(block);
+        blockLoaded.notify_all();
+        throw;
+    }
+    std::shared_ptr<unsigned char[]> data(decoded.second);
+
+    lk.lock();
+    blockLoading.erase(block);
+    if (data) {
+        blockCache.push_front({block, decoded.first, data});
+        if (blockCache.size() > SOLID_CACHE_BLOCKS) blockCache.pop_back();
+    }
+    blockLoaded.notify_all();
+    return {decoded.first, data};
+}
+
+std::pair<size_t, unsigned char*> DArchive::decodeEntry(unsigned int fsid, unsigned char& prop, std::istream& in) {
+    if (fsid >= fileCount) throw DArchiveException("FSID is out of the range.");
+
+    if (isFramed(fsid)) {
+        // Every frame but the last holds exactly frameSize bytes.
+        const FrameRef& ref = frameRefs[fsid];
+        size_t capacity = ref.ends.size() * ref.frameSize, size = 0;
+        unsigned char* data = new unsigned char[capacity];
+        try {
+            for (size_t i = 0; i < ref.ends.size(); i++) {
+                auto [len, out] = decodeFrame(fsid, i, prop, in, data + size, capacity - size);
+                if (!out) {
+                    delete[] data;
+                    return {0, nullptr};
+                }
+                size += len;
+            }
+        }
+        catch (...) {
+            delete[] data;
+            throw;
+        }
+        return {size, data};
+    }
+
+    Mask mask;
     size_t size = fileSizes[fsid];
+    unsigned char* data;
 
-    unsigned char* data = new unsigned char[size];
-    is.read((char*) data, size);
-    mask.versionId(arcVersion);
-    mask.unmask(data, size);
-    if (arcVersion >= 1) {
-        mask.unmask(data, size);
-        mask.unmask(data, size);
+    if (map.isMapped()) {
+        if (fileOffsets[fsid] + 225 + size > map.size()) {
+            good = false;
+            throw DArchiveException("Entry is out of the archive.");
+        }
+        BitInput ib(map.data() + fileOffsets[fsid], 225);
+        prop = ib.read(7);
+        mask.read(ib);
+
+        data = new unsigned char[size];
+        std::memcpy(data, map.data() + fileOffsets[fsid] + 225, size);
     }
+    else {
+        unsigned char header[225];
+        readAt(in, fileOffsets[fsid], header, sizeof(header));
+
+        BitInput ib(header, sizeof(header));
+        prop = ib.read(7);
+        mask.read(ib);
 
+        data = new unsigned char[size];
+        try {
+            readAt(in, fileOffsets[fsid] + 225, data, size);
+        }
+        catch (...) {
+            delete[] data;
+            throw;
+        }
+    }
+    mask.versionId(std::min(arcVersion, 2));
+    mask.unmask(data, size, arcVersion >= 1 ? MASK_ROUNDS : 1);
+    return decodePayload(prop, data, size);
+}
+
+// Decrypts and decompresses an unmasked payload, taking `data` over. With
+// `dest` the result goes there instead of a new buffer.
+std::pair<size_t, unsigned char*> DArchive::decodePayload(unsigned char prop, unsigned char* data, size_t size, unsigned char* dest, size_t capacity) {
     if (prop & Conf::ENCRYPTED) {
         auto[nsize, ndata] = decrypt_data(data, size);
         delete[] data;
@@ -253,6 +604,16 @@ std::pair<size_t, unsigned char*> DArchive::extractData(unsigned int fsid, unsig
         size = nsize;
     }
 
+    if (dest) {
+        size_t len = size;
+        if (prop & Conf::COMPRESSED) len = ZSTD_decompressDCtx(threadDCtx(), dest, capacity, data, size);
+        else if (size <= capacity) std::memcpy(dest, data, size);
+        delete[] data;
+        if (ZSTD_isError(len)) throw DArchiveException("Decompression failed: " + std::string(ZSTD_getErrorName(len)));
+        if (len > capacity) throw DArchiveException("Frame is larger than its frame size.");
+        return {len, dest};
+    }
+
     if (prop & Conf::COMPRESSED) {
         auto[nsize, ndata] = decompress_data(data, size);
         delete[] data;
@@ -267,45 +628,571 @@ std::pair<size_t, unsigned char*> DArchive::extractData(unsigned int fsid, unsig
     return {size, data};
 }
 
+// Frame `index` of a seekable entry, decoded on its own, into `dest` when
+// given. A plain frame is read and unmasked right there.
+std::pair<size_t, unsigned char*> DArchive::decodeFrame(unsigned int fsid, size_t index, unsigned char& prop, std::istream& in, unsigned char* dest, size_t capacity) {
+    const FrameRef& ref = frameRefs[fsid];
+    unsigned char header[225];
+    readAt(in, fileOffsets[fsid], header, sizeof(header));
+    BitInput ib(header, sizeof(header));
+    prop = ib.read(7);
+    Mask mask;
+    mask.read(ib);
+    mask.versionId(std::min(arcVersion, 2));
+
+    size_t begin = index ? ref.ends[index - 1] : 0, size = ref.ends[index] - begin;
+    if (dest && !(prop & (Conf::ENCRYPTED | Conf::COMPRESSED))) {
+        if (size > capacity) throw DArchiveException("Frame is larger than its frame size.");
+        readAt(in, fileOffsets[fsid] + 225 + begin, dest, size);
+        mask.unmask(dest, size, MASK_ROUNDS);
+        return {size, dest};
+    }
+    unsigned char* data = new unsigned char[size];
+    try {
+        readAt(in, fileOffsets[fsid] + 225 + begin, data, size);
+    }
+    catch (...) {
+        delete[] data;
+        throw;
+    }
+    mask.unmask(data, size, MASK_ROUNDS);
+    return decodePayload(prop, data, size, dest, capacity);
+}
+
+// Reads [offset, offset + len) of a file entry, clipped to its end, and
+// returns the byte count. Seekable entries decode only the frames the
+// range overlaps; others are decoded whole.
+size_t DArchive::ReadRange(unsigned int fsid, unsigned long long offset, void* buf, size_t len) {
+    if (fsid >= fileCount) throw DArchiveException("FSID is out of the range.");
+    unsigned char prop;
+    unsigned int source = payloadOf(fsid);
+    if (!isFramed(source)) {
+        auto [size, data] = cachedEntry(source);
+        if (!data) return 0;
+        size_t count = offset < size ? std::min<size_t>(len, size - offset) : 0;
+        std::memcpy(buf, data.get() + offset, count);
+        return count;
+    }
+
+    const FrameRef& ref = frameRefs[source];
+    std::ifstream local;
+    std::istream& in = readerStream(local);
+    size_t count = 0;
+    std::vector<unsigned char> frame;
+    for (size_t i = offset / ref.frameSize; i < ref.ends.size() && count < len; i++) {
+        size_t skip = offset + count - i * ref.frameSize;
+        unsigned char* out = (unsigned char*) buf + count;
+        // Frames the range covers whole are decoded straight into `buf`.
+        bool whole = !skip && len - count >= ref.frameSize;
+        if (!whole) frame.resize(ref.frameSize);
+        auto [size, data] = decodeFrame(source, i, prop, in, whole ? out : frame.data(), ref.frameSize);
+        if (!data) break;
+        size_t part = skip < size ? std::min(len - count, size - skip) : 0;
+        if (!whole) std::memcpy(out, data + skip, part);
+        count += part;
+        if (size < ref.frameSize) break;
+    }
+    return count;
+}
+
+// Whole decoded entries, most recently used first, up to ENTRY_CACHE_BYTES.
+std::pair<size_t, std::shared_ptr<unsigned char[]>> DArchive::cachedEntry(unsigned int fsid) {
+    {
+        std::lock_guard<std::mutex> lk(entryLock);
+        auto it = entryIndex.find(fsid);
+        if (it != entryIndex.end()) {
+            entryCache.splice(entryCache.begin(), entryCache, it->second);
+            return {std::get<1>(*it->second), std::get<2>(*it->second)};
+        }
+    }
+
+    unsigned char prop;
+    std::ifstream local;
+    auto [size, raw] = extractData(fsid, prop, readerStream(local));
+    std::shared_ptr<unsigned char[]> data(raw);
+    if (!data || size > ENTRY_CACHE_BYTES) return {size, data};
+
+    std::lock_guard<std::mutex> lk(entryLock);
+    if (entryIndex.count(fsid)) return {size, data};
+    entryCache.push_front({fsid, size, data});
+    entryIndex[fsid] = entryCache.begin();
+    entryCached += size;
+    while (entryCached > ENTRY_CACHE_BYTES) {
+        entryCached -= std::get<1>(entryCache.back());
+        entryIndex.erase(std::get<0>(entryCache.back()));
+        entryCache.pop_back();
+    }
+    return {size, data};
+}
+
+// Calls that may run concurrently read through their own stream unless the
+// archive is mapped.
+std::istream& DArchive::readerStream(std::ifstream& local) {
+    if (map.isMapped()) return is;
+    local.open(toPlatformPath(archiveName), std::ios::binary);
+    if (!local) throw DArchiveException("Unable to reopen the archive.");
+    return local;
+}
+
+std::pair<size_t, std::shared_ptr<unsigned char[]>> DArchive::ReadEntry(unsigned int fsid) {
+    unsigned int target = resolveLink(fsid);
+    if (target == 0xffffffff) throw DArchiveException("Unresolvable entry.");
+    return cachedEntry(payloadOf(target));
+}
+
+// Serves a seekable entry frame by frame and any other from its whole
+// decoded contents. The window always holds one whole frame; `base` is
+// where it starts, or the position to resume at while there is none.
+class EntryBuf : public std::streambuf {
+private:
+    DArchive& arch;
+    unsigned int fsid;
+    std::shared_ptr<unsigned char[]> data;
+    std::vector<char> chunk;
+    unsigned long long size, base;
+
+public:
+    EntryBuf(DArchive& arch, unsigned int fsid, unsigned long long size, size_t frameSize)
+        : arch(arch), fsid(fsid), chunk(frameSize), size(size), base(0) {
+        setg(nullptr, nullptr, nullptr);
+    }
+    EntryBuf(DArchive& arch, std::pair<size_t, std::shared_ptr<unsigned char[]>> whole)
+        : arch(arch), fsid(0), data(whole.second), size(whole.first), base(0) {
+        char* p = (char*) data.get();
+        setg(p, p, p + size);
+    }
+
+protected:
+    int_type underflow() override {
+        if (data) return traits_type::eof();
+        unsigned long long pos = eback() ? base + (egptr() - eback()) : base;
+        if (pos >= size) return traits_type::eof();
+        base = pos - pos % chunk.size();
+        size_t got = arch.ReadRange(fsid, base, chunk.data(), chunk.size());
+        if (got <= pos - base) {
+            base = pos;
+            setg(nullptr, nullptr, nullptr);
+            return traits_type::eof();
+        }
+        setg(chunk.data(), chunk.data() + (pos - base), chunk.data() + got);
+        return traits_type::to_int_type(*gptr());
+    }
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        unsigned long long pos = (data ? 0 : base) + (gptr() - eback());
+        if (dir == std::ios_base::beg) pos = off;
+        else if (dir == std::ios_base::cur) pos += off;
+        else pos = size + off;
+        return seekpos(pos, which);
+    }
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+        if (!(which & std::ios_base::in) || pos < 0 || (unsigned long long) pos > size) return pos_type(off_type(-1));
+        if (data) {
+            setg(eback(), eback() + pos, egptr());
+            return pos;
+        }
+        base = pos;
+        setg(nullptr, nullptr, nullptr);
+        return pos;
+    }
+};
+
+class EntryStream : public std::istream {
+private:
+    EntryBuf buf;
+
+public:
+    template<typename... Args>
+    EntryStream(Args&&... args) : std::istream(nullptr), buf(std::forward<Args>(args)...) {
+        rdbuf(&buf);
+    }
+};
+
+std::unique_ptr<std::istream> DArchive::OpenEntry(unsigned int fsid) {
+    unsigned int target = resolveLink(fsid);
+    if (target == 0xffffffff) throw DArchiveException("Unresolvable entry.");
+    unsigned int source = payloadOf(target);
+    if (isFramed(source)) return std::make_unique<EntryStream>(*this, source, getSize(source), frameRefs[source].frameSize);
+    return std::make_unique<EntryStream>(*this, cachedEntry(source));
+}
+
+DArchive::iterator::iterator(DArchive* arch) : arch(arch) {
+    if (!arch) return;
+    for (auto it = arch->rootdir.rbegin(); it != arch->rootdir.rend(); it++) {
+        pending.push_back({*it, std::string(arch->fileNames[*it])});
+    }
+    next();
+}
+
+void DArchive::iterator::next() {
+    if (pending.empty()) {
+        arch = nullptr;
+        return;
+    }
+    auto [fsid, path] = pending.back();
+    pending.pop_back();
+    current.fsid = fsid;
+    current.symlink = arch->isSymlink(fsid);
+    current.directory = !current.symlink && arch->isDirectory(fsid);
+    current.size = current.directory ? 0 : arch->getSize(current.symlink ? arch->resolveLink(fsid) : fsid);
+    if (current.directory) {
+        auto children = arch->listDirectory(fsid);
+        for (auto it = children.rbegin(); it != children.rend(); it++) {
+            pending.push_back({*it, path + "/" + std::string(arch->fileNames[*it])});
+        }
+    }
+    current.path = std::move(path);
+}
+
+DArchive::iterator DArchive::begin() { return iterator(this); }
+
+DArchive::iterator DArchive::end() { return iterator(); }
+
+void DArchive::SetPasswordCallbacks(std::function<bool(unsigned int)> missing, std::function<bool(unsigned int)> incorrect) {
+    missingPassword = missing;
+    incorrectPassword = incorrect;
+}
+
 bool DArchive::isGood() { return good; }
 
-void DArchive::FSTable() {
-    is.seekg(fstOffset);
+void DArchive::readAt(std::istream& in, size_t offset, void* buf, size_t len) {
+    if (map.isMapped()) {
+        if (offset > map.size() || len > map.size() - offset) {
+            good = false;
+            throw DArchiveException("Read past the end of the archive.");
+        }
+        std::memcpy(buf, map.data() + offset, len);
+        return;
+    }
+    in.seekg(offset, std::ios::beg);
+    if (!in.read((char*) buf, len)) {
+        in.clear();
+        good = false;
+        throw DArchiveException("Read past the end of the archive.");
+    }
+}
+
+// Version 3 archives carry [id u32][size u64][payload] sections after the
+// end tag of the FS table, closed by a bare END id.
+void DArchive::readSections(size_t offset) {
+    size_t total = map.isMapped() ? map.size() : (size_t) -1;
     while (true) {
-        unsigned short fnSize = 0;
-        unsigned long long fileOffset = 0;
-        unsigned char tmp = 0;
-        for (unsigned int i = 0; i < 2; i++) {
-            is.read((char*) &tmp, 1);
-            fnSize |= (((unsigned short) tmp) << (i << 3));
+        unsigned char head[12];
+        readAt(is, offset, head, 4);
+        unsigned int id = LE::get(head, 4);
+        if (id == Section::END) break;
+        readAt(is, offset + 4, head + 4, 8);
+        unsigned long long size = LE::get(head + 4, 8);
+        offset += 12;
+        if (size > total - offset) {
+            good = false;
+            throw DArchiveException("Truncated archive section.");
         }
-        if (fnSize == 0x8000) break;
-        char* fn = new char[fnSize];
-        is.read(fn, fnSize);
-        fileNames.push_back(std::string(fn, fnSize));
-        for (unsigned int i = 0; i < 8; i++) {
-            is.read((char*) &tmp, 1);
-            fileOffset |= (((unsigned long long) tmp) << (i << 3));
+        sections[id] = {offset, size};
+        offset += size;
+    }
+
+    std::vector<unsigned char> keyData;
+    if (readSection(Section::KEYS, keyData)) {
+        if (keyData.size() < 4) throw DArchiveException("Invalid key section.");
+        unsigned int count = LE::get(keyData.data(), 4);
+        if ((keyData.size() - 4) / (5 + SALT_SIZE) < count) throw DArchiveException("Invalid key section.");
+        const unsigned char* p = keyData.data() + 4;
+        for (unsigned int i = 0; i < count; i++, p += 5 + SALT_SIZE) {
+            keySchemes[LE::get(p, 4)] = {p[4], std::vector<unsigned char>(p + 5, p + 5 + SALT_SIZE)};
         }
+    }
+
+    if (readSection(Section::PATHS, pathIndex) && !PathIndex::valid(pathIndex)) {
+        throw DArchiveException("Invalid path index section.");
+    }
+
+    std::vector<unsigned char> nodeData;
+    if (readSection(Section::NODES, nodeData)) {
+        const size_t recordSize = 21;
+        if (nodeData.size() != (size_t) fileCount * recordSize) throw DArchiveException("Invalid node section.");
+        const unsigned char* p = nodeData.data();
+        for (unsigned int i = 0; i < fileCount; i++, p += recordSize) {
+            NodeInfo& node = nodes[i];
+            // An update leaves the old FS table between an entry and the
+            // next one, so the recorded size may be short of the gap.
+            unsigned long long size = LE::get(p + 1, 8);
+            if (size > fileSizes[i]) throw DArchiveException("Invalid node section.");
+            fileSizes[i] = size;
+            node.prop = p[0];
+            node.rawSize = LE::get(p + 9, 8);
+            node.parent = LE::get(p + 17, 4);
+            node.known = true;
+            node.loaded = !(node.prop & Conf::SYMLINK);
+            if (node.parent < fileCount) nodes[node.parent].children.push_back(i);
+        }
+    }
+
+    std::vector<unsigned char> dictData;
+    if (readSection(Section::DICT, dictData)) {
+        ddict = ZSTD_createDDict(dictData.data(), dictData.size());
+        if (!ddict) throw DArchiveException("Invalid dictionary section.");
+    }
+
+    std::vector<unsigned char> dedupData;
+    if (readSection(Section::DEDUP, dedupData)) {
+        if (dedupData.size() % 8) throw DArchiveException("Invalid dedup section.");
+        dedupSources.assign(fileCount, 0xffffffff);
+        for (const unsigned char* p = dedupData.data(); p < dedupData.data() + dedupData.size(); p += 8) {
+            unsigned int fsid = LE::get(p, 4), source = LE::get(p + 4, 4);
+            if (fsid >= fileCount || source >= fileCount) throw DArchiveException("Invalid dedup section.");
+            dedupSources[fsid] = source;
+        }
+        for (auto source : dedupSources) {
+            if (source != 0xffffffff && dedupSources[source] != 0xffffffff) throw DArchiveException("Invalid dedup section.");
+        }
+    }
+
+    std::vector<unsigned char> frameData;
+    if (readSection(Section::FRAMES, frameData)) {
+        frameRefs.resize(fileCount);
+        const unsigned char* p = frameData.data(), *end = p + frameData.size();
+        while (p < end) {
+            if (end - p < 12) throw DArchiveException("Invalid frame section.");
+            unsigned int fsid = LE::get(p, 4), count = LE::get(p + 8, 4);
+            size_t frameSize = LE::get(p + 4, 4);
+            p += 12;
+            if (fsid >= fileCount || !frameSize || !count || (size_t) (end - p) / 8 < count) {
+                throw DArchiveException("Invalid frame section.");
+            }
+            FrameRef& ref = frameRefs[fsid];
+            ref.frameSize = frameSize;
+            for (unsigned int i = 0; i < count; i++, p += 8) {
+                unsigned long long frameEnd = LE::get(p, 8);
+                if (frameEnd <= (i ? ref.ends.back() : 0)) throw DArchiveException("Invalid frame section.");
+                ref.ends.push_back(frameEnd);
+            }
+            if (ref.ends.back() != fileSizes[fsid]) throw DArchiveException("Invalid frame section.");
+        }
+    }
+
+    std::vector<unsigned char> solidData;
+    if (readSection(Section::SOLID, solidData)) {
+        if (solidData.size() % 16) throw DArchiveException("Invalid solid section.");
+        solidRefs.resize(fileCount);
+        for (const unsigned char* p = solidData.data(); p < solidData.data() + solidData.size(); p += 16) {
+            unsigned int fsid = LE::get(p, 4), block = LE::get(p + 4, 4);
+            if (fsid >= fileCount || block >= fileCount) throw DArchiveException("Invalid solid section.");
+            solidRefs[fsid] = {block, (size_t) LE::get(p + 8, 4), (size_t) LE::get(p + 12, 4)};
+        }
+    }
+}
+
+bool DArchive::readSection(unsigned int id, std::vector<unsigned char>& data) {
+    auto it = sections.find(id);
+    if (it == sections.end()) return false;
+    data.resize(it->second.second);
+    if (data.size()) readAt(is, it->second.first, data.data(), data.size());
+    return true;
+}
+
+size_t DArchive::readTable() {
+    size_t total = map.isMapped() ? map.size() : 0;
+    if (!map.isMapped()) {
+        is.seekg(0, std::ios::end);
+        total = is.tellg();
+    }
+    unsigned char head[8];
+    readAt(is, fstOffset, head, 8);
+    unsigned long long blockSize = LE::get(head, 8);
+    if (blockSize > total - fstOffset - 8) {
+        good = false;
+        throw DArchiveException("Truncated FS table.");
+    }
+
+    const unsigned char* p;
+    if (map.isMapped()) p = map.data() + fstOffset + 8;
+    else {
+        tableBlock.resize(blockSize);
+        if (blockSize) readAt(is, fstOffset + 8, tableBlock.data(), blockSize);
+        p = tableBlock.data();
+    }
+    const unsigned char* end = p + blockSize;
+
+    unsigned long long count, nameCount;
+    if (!Varint::get(p, end, count) || !Varint::get(p, end, nameCount) || nameCount > blockSize || count > blockSize) {
+        throw DArchiveException("Invalid FS table.");
+    }
+    std::vector<std::string_view> pool;
+    for (unsigned long long i = 0; i < nameCount; i++) {
+        unsigned long long len;
+        if (!Varint::get(p, end, len) || len > (size_t) (end - p)) throw DArchiveException("Invalid FS table.");
+        pool.emplace_back((const char*) p, len);
+        p += len;
+    }
+    unsigned long long fileOffset = 0;
+    for (unsigned long long i = 0; i < count; i++) {
+        unsigned long long nameId, delta;
+        if (!Varint::get(p, end, nameId) || !Varint::get(p, end, delta) || nameId >= nameCount) {
+            throw DArchiveException("Invalid FS table.");
+        }
+        fileOffset += delta;
+        fileNames.push_back(pool[nameId]);
         fileOffsets.push_back(fileOffset);
         fileCount++;
     }
+    return fstOffset + 8 + blockSize;
+}
+
+size_t DArchive::readLegacyTable() {
+    if (map.isMapped()) {
+        const unsigned char* p = map.data() + fstOffset;
+        const unsigned char* end = map.data() + map.size();
+        if (fstOffset > map.size()) {
+            good = false;
+            throw DArchiveException("FS table is out of the archive.");
+        }
+        while (true) {
+            if (end - p < 2) throw DArchiveException("Truncated FS table.");
+            unsigned short fnSize = p[0] | (((unsigned short) p[1]) << 8);
+            p += 2;
+            if (fnSize == 0x8000) break;
+            if ((size_t) (end - p) < fnSize + 8u) throw DArchiveException("Truncated FS table.");
+            fileNames.push_back(std::string_view((const char*) p, fnSize));
+            p += fnSize;
+            unsigned long long fileOffset = 0;
+            for (unsigned int i = 0; i < 8; i++) {
+                fileOffset |= (((unsigned long long) p[i]) << (i << 3));
+            }
+            p += 8;
+            fileOffsets.push_back(fileOffset);
+            fileCount++;
+        }
+        return p - map.data();
+    }
+
+    std::vector<std::pair<size_t, size_t>> spans;
+    is.seekg(fstOffset);
+    while (true) {
+        unsigned char tmp[8];
+        if (!is.read((char*) tmp, 2)) throw DArchiveException("Truncated FS table.");
+        unsigned short fnSize = LE::get(tmp, 2);
+        if (fnSize == 0x8000) break;
+        spans.push_back({tableBlock.size(), fnSize});
+        tableBlock.resize(tableBlock.size() + fnSize);
+        if (!is.read((char*) tableBlock.data() + spans.back().first, fnSize) || !is.read((char*) tmp, 8)) {
+            throw DArchiveException("Truncated FS table.");
+        }
+        fileOffsets.push_back(LE::get(tmp, 8));
+        fileCount++;
+    }
+    for (auto [start, len] : spans) {
+        fileNames.push_back(std::string_view((const char*) tableBlock.data() + start, len));
+    }
+    return is.tellg();
+}
+
+void DArchive::FSTable() {
+    size_t tableEnd = arcVersion >= 4 ? readTable() : readLegacyTable();
     fileOffsets.push_back(fstOffset);
 
     for (unsigned int i = 0; i < fileCount; i++) {
         fileSizes.push_back(fileOffsets[i + 1] - fileOffsets[i] - 225);
     }
+    nodes.assign(fileCount, NodeInfo());
+
+    if (arcVersion >= 3) readSections(tableEnd);
 
-    std::cout << "Got " << fileCount << " files." << std::endl;
+    if (!quiet) std::cout << "Got " << fileCount << " files." << std::endl;
+}
+
+unsigned char DArchive::peekProp(unsigned int fsid) {
+    std::lock_guard<std::recursive_mutex> lk(nodeLock);
+    NodeInfo& node = nodes[fsid];
+    if (node.known) return node.prop;
+    unsigned char head;
+    readAt(is, fileOffsets[fsid], &head, 1);
+    node.prop = BitInput(&head, 1).read(7);
+    node.known = true;
+    return node.prop;
+}
+
+// The key index an encrypted entry was written with. It heads the payload,
+// so only the mask has to be undone, not the cipher.
+unsigned int DArchive::keyIndexOf(unsigned int fsid) {
+    if (fsid >= fileCount) throw DArchiveException("FSID is out of the range.");
+    fsid = payloadOf(fsid);
+    size_t size = isFramed(fsid) ? frameRefs[fsid].ends[0] : fileSizes[fsid];
+    std::ifstream local;
+    std::istream& in = readerStream(local);
+    unsigned char header[225];
+    readAt(in, fileOffsets[fsid], header, sizeof(header));
+    BitInput ib(header, sizeof(header));
+    unsigned char prop = ib.read(7);
+    if (!(prop & Conf::ENCRYPTED) || size < 4) throw DArchiveException("Entry is not encrypted.");
+    Mask mask;
+    mask.read(ib);
+    mask.versionId(std::min(arcVersion, 2));
+
+    std::vector<unsigned char> data(size);
+    readAt(in, fileOffsets[fsid] + 225, data.data(), size);
+    mask.unmask(data.data(), size, arcVersion >= 1 ? MASK_ROUNDS : 1);
+    return LE::get(data.data(), 4);
+}
+
+const DArchive::NodeInfo* DArchive::nodeOf(unsigned int fsid) {
+    if (fsid >= fileCount) return nullptr;
+    std::lock_guard<std::recursive_mutex> lk(nodeLock);
+    NodeInfo& node = nodes[fsid];
+    if (node.loaded) return &node;
+
+    unsigned char prop = peekProp(fsid);
+    unsigned int link = 0xffffffff;
+    std::vector<unsigned int> children;
+    if (prop & (Conf::SYMLINK | Conf::PATH)) {
+        auto [size, raw] = extractData(fsid, prop);
+        if (!good) return nullptr;
+        std::unique_ptr<unsigned char[]> data(raw);
+        if (prop & Conf::SYMLINK) {
+            if (size != 4) return nullptr;
+            link = LE::get(data.get(), 4);
+            if (link >= fileCount) return nullptr;
+        }
+        else {
+            if (size < 4) return nullptr;
+            unsigned int count = LE::get(data.get(), 4);
+            if (size != 4 + ((size_t) count << 2)) return nullptr;
+            for (unsigned int i = 0; i < count; i++) {
+                unsigned int child = LE::get(data.get() + (i + 1) * 4, 4);
+                if (child >= fileCount) return nullptr;
+                children.push_back(child);
+            }
+        }
+    }
+
+    node.prop = prop;
+    node.known = true;
+    node.link = link;
+    node.children = std::move(children);
+    node.loaded = true;
+    for (auto child : node.children) {
+        if (nodes[child].parent == 0xffffffff) nodes[child].parent = fsid;
+    }
+    return &node;
+}
+
+const DArchive::NodeInfo* DArchive::resolveNode(unsigned int fsid) {
+    std::lock_guard<std::recursive_mutex> lk(nodeLock);
+    const NodeInfo* node = nodeOf(fsid);
+    if (!node || !(node->prop & Conf::SYMLINK)) return node;
+    if (node->resolved != 0xffffffff) return &nodes[node->resolved];
+
+    const NodeInfo* target = node;
+    for (unsigned int hops = 0; target && (target->prop & Conf::SYMLINK); hops++) {
+        if (hops >= fileCount) return nullptr;
+        target = nodeOf(target->link);
+    }
+    if (target) nodes[fsid].resolved = target - nodes.data();
+    return target;
 }
 
 void DArchive::TestRootdir() {
     for (unsigned int i = 0; i < fileCount; i++) {
-        is.seekg(fileOffsets[i], std::ios::beg);
-        unsigned char prop;
-        is.read((char*) &prop, 1);
-        prop >>= 1;
-        if (prop & Conf::ROOTDIR) {
+        if (peekProp(i) & Conf::ROOTDIR) {
             rootdir.push_back(i);
         }
     }
@@ -325,105 +1212,170 @@ std::vector<std::string> extract_segments(const std::filesystem::path& raw_path)
     return segments;
 }
 
-void DArchive::Extract(unsigned int fsid, std::filesystem::path path) {
-    unsigned char prop;
-    auto[size, data] = extractData(fsid, prop);
-    if (!good) return;
-    std::error_code ec;
+class ExtractPool {
+private:
+    DArchive& arch;
+    std::vector<std::thread> workers;
+    std::queue<std::pair<unsigned int, std::filesystem::path>> jobs;
+    std::mutex lock;
+    std::condition_variable queued, idle;
+    unsigned int busy;
+    bool stop;
+    std::exception_ptr error;
+
+    void run() {
+        std::ifstream in;
+        if (!arch.map.isMapped()) in.open(toPlatformPath(arch.archiveName), std::ios::binary);
+        while (true) {
+            std::pair<unsigned int, std::filesystem::path> job;
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                queued.wait(lk, [&]() { return stop || !jobs.empty(); });
+                if (jobs.empty()) return;
+                job = jobs.front();
+                jobs.pop();
+                busy++;
+            }
+            try {
+                if (!arch.map.isMapped() && !in) throw DArchiveException("Unable to reopen the archive.");
+                arch.extractFile(job.first, job.second, in);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lk(lock);
+                if (!error) error = std::current_exception();
+                while (!jobs.empty()) jobs.pop();
+            }
+            {
+                std::lock_guard<std::mutex> lk(lock);
+                busy--;
+            }
+            idle.notify_all();
+        }
+    }
 
-    if (prop & Conf::SYMLINK) {
-        unsigned int nfsid = 0;
-        if (size != 4) {
-            good = false;
-            delete[] data;
-            throw DArchiveException("Invalid symlink data size.");
+public:
+    void submit(unsigned int fsid, std::filesystem::path path) {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            if (error) return;
+            jobs.push({fsid, path});
         }
-        for (unsigned int i = 0; i < 4; i++) {
-            nfsid |= (((unsigned int) data[i]) << (i << 3));
+        queued.notify_one();
+    }
+
+    // Blocks until every submitted entry is written, rethrowing the first
+    // worker failure.
+    void wait() {
+        std::unique_lock<std::mutex> lk(lock);
+        idle.wait(lk, [&]() { return jobs.empty() && busy == 0; });
+        if (error) {
+            auto err = error;
+            error = nullptr;
+            lk.unlock();
+            std::rethrow_exception(err);
         }
-        Extract(nfsid, path);
-        delete[] data;
-        return;
     }
 
-    if (prop & Conf::PATH) {
-        std::cout << "Create   " << path.lexically_normal().generic_u8string() << std::endl;
-        std::filesystem::create_directory(toPlatformPath(path), ec);
-        if (ec) {
-            good = false;
-            delete[] data;
-            throw DArchiveException("Failed to create directory: " + ec.message());
+    ExtractPool(DArchive& arch, unsigned int count) : arch(arch), busy(0), stop(false) {
+        for (unsigned int i = 0; i < count; i++) workers.emplace_back([this]() { run(); });
+    }
+
+    ~ExtractPool() {
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            stop = true;
+            while (!jobs.empty()) jobs.pop();
         }
-        if (size < 4) {
+        queued.notify_all();
+        for (auto& t : workers) t.join();
+    }
+};
+
+void DArchive::extractNode(unsigned int fsid, std::filesystem::path path, ExtractPool* pool) {
+    if (fsid >= fileCount) {
+        good = false;
+        throw DArchiveException("FSID is out of the range.");
+    }
+    unsigned char prop = peekProp(fsid);
+    std::error_code ec;
+
+    if (prop & (Conf::SYMLINK | Conf::PATH)) {
+        const NodeInfo* node = nodeOf(fsid);
+        if (!node) {
+            if (!good) return;
             good = false;
-            delete[] data;
-            throw DArchiveException("Invalid directory data size.");
+            throw DArchiveException((prop & Conf::SYMLINK) ? "Invalid symlink data." : "Invalid directory data.");
         }
-        unsigned int count = 0, nfsid;
-        for (unsigned int i = 0; i < 4; i++) {
-            count |= (((unsigned int) data[i]) << (i << 3));
+        if (prop & Conf::SYMLINK) {
+            extractNode(node->link, path, pool);
+            return;
         }
-        if (size != 4 + (count << 2)) {
+        if (!quiet) std::cout << "Create   " << path.lexically_normal().generic_u8string() << std::endl;
+        std::filesystem::create_directory(toPlatformPath(path), ec);
+        if (ec) {
             good = false;
-            delete[] data;
-            throw DArchiveException("Invalid directory data size.");
+            throw DArchiveException("Failed to create directory: " + ec.message());
         }
-        for (unsigned int i = 0; i < count; i++) {
-            nfsid = 0;
-            for (unsigned int j = 0; j < 4; j++) {
-                nfsid |= (((unsigned int) data[(i + 1) * 4 + j]) << (j << 3));
-            }
-            if (nfsid >= fileCount) {
-                good = false;
-                delete[] data;
-                throw DArchiveException("FSID is out of the range in directory extraction.");
-            }
-            Extract(nfsid, path / std::filesystem::u8path(fileNames[nfsid]));
-            if (!good) {
-                delete[] data;
-                throw DArchiveException("Failed to extract directory contents.");
-            }
+        for (auto child : node->children) {
+            extractNode(child, path / std::filesystem::u8path(fileNames[child]), pool);
+            if (!good) throw DArchiveException("Failed to extract directory contents.");
         }
-        delete[] data;
         return;
     }
 
-    if (prop & Conf::SCRIPT) {
-        if (safeMode) {
-            data += 4;
-            size -= 4;
+    if ((pool || fileSizes[payloadOf(fsid)] > bufferSize) && !(prop & Conf::SCRIPT) && (safeMode || !(prop & Conf::NETWORK))) {
+        if (!quiet) std::cout << "Extract  " << path.lexically_normal().generic_u8string() << std::endl;
+        if (pool) pool->submit(fsid, path);
+        else extractFile(fsid, path, is);
+        return;
+    }
+    auto[size, data] = extractData(fsid, prop);
+    if (!good) return;
+
+    if ((prop & Conf::SCRIPT) && !safeMode) {
+        unsigned int pri = 0;
+        for (unsigned int i = 0; i < 4; i++) {
+            pri |= (((unsigned int) data[i]) << (i << 3));
         }
-        else {
-            unsigned int pri;
-            for (unsigned int i = 0; i < 4; i++) {
-                pri |= (((unsigned int) data[i]) << (i << 3));
-            }
-            std::string script((char*) (data + 4), size - 4);
-            if (pri == 0) {
-                std::cout << "Execute  " << path.lexically_normal().generic_u8string() << std::endl;
-                RunPostScript(script, path.lexically_normal().generic_u8string());
-            }
-            else tasks.push_back({pri, script, path.lexically_normal().generic_u8string()});
-            delete[] data;
-            return;
+        std::string script((char*) (data + 4), size - 4);
+        delete[] data;
+        if (pri == 0) {
+            // The script may use anything extracted or downloaded before it.
+            if (pool) pool->wait();
+            finishDownloads();
+            if (!quiet) std::cout << "Execute  " << path.lexically_normal().generic_u8string() << std::endl;
+            runScript(script, path.lexically_normal().generic_u8string());
         }
+        else tasks.push_back({pri, script, path.lexically_normal().generic_u8string()});
+        return;
     }
 
     if ((prop & Conf::NETWORK) && !safeMode) {
         while (isspace(data[size - 1])) size--;
         std::string url((char*) data, size);
         delete[] data;
-        std::cout << "Download " << path.lexically_normal().generic_u8string() << " (" << url << ')' << std::endl;
-        if (!download(url, path)) {
-            std::cout << "Leaving the URL..." << std::endl;
-            std::ofstream os(toPlatformPath(path), std::ios::binary);
-            os.write(url.data(), url.size());
-            os.close();
+        if (!quiet) std::cout << "Download " << path.lexically_normal().generic_u8string() << " (" << url << ')' << std::endl;
+        if (!downloads) {
+            if (!curlState) {
+                curl_global_init(CURL_GLOBAL_DEFAULT);
+                curlState = true;
+            }
+            downloads.reset(new DownloadPool(connections));
         }
+        downloads->submit(url, path);
         return;
     }
 
-    std::cout << "Extract  " << path.lexically_normal().generic_u8string() << std::endl;
+    if (!quiet) std::cout << "Extract  " << path.lexically_normal().generic_u8string() << std::endl;
+    writeFile(prop, data, size, path);
+}
+
+void DArchive::writeFile(unsigned char prop, unsigned char* data, size_t size, const std::filesystem::path& path) {
+    if (prop & Conf::SCRIPT && safeMode) {
+        data += 4;
+        size -= 4;
+    }
+
     std::ofstream os(toPlatformPath(path), std::ios::binary);
     os.write((char*) data, size);
     os.close();
@@ -433,9 +1385,202 @@ void DArchive::Extract(unsigned int fsid, std::filesystem::path path) {
     delete[] data;
 }
 
+void DArchive::extractFile(unsigned int fsid, const std::filesystem::path& path, std::istream& in) {
+    unsigned int source = payloadOf(fsid);
+    if (isFramed(source)) {
+        writeFrames(source, path, in);
+        return;
+    }
+    if (fileSizes[source] > bufferSize && !isSolid(source)) {
+        streamFile(source, path, in);
+        return;
+    }
+    unsigned char prop;
+    auto[size, data] = extractData(fsid, prop, in);
+    if (data) writeFile(prop, data, size, path);
+}
+
+// Seekable entries are written out one frame at a time.
+void DArchive::writeFrames(unsigned int fsid, const std::filesystem::path& path, std::istream& in) {
+    std::ofstream os(toPlatformPath(path), std::ios::binary);
+    unsigned char prop;
+    std::vector<unsigned char> frame(frameRefs[fsid].frameSize);
+    for (size_t i = 0; i < frameRefs[fsid].ends.size(); i++) {
+        auto [size, data] = decodeFrame(fsid, i, prop, in, frame.data(), frame.size());
+        if (!data) return;
+        os.write((const char*) data, size);
+    }
+}
+
+// Decodes a plain file entry through windows of bufferSize bytes: the
+// mask passes, the cipher and the zstd stream, writing as it goes.
+void DArchive::streamFile(unsigned int fsid, const std::filesystem::path& path, std::istream& in) {
+    unsigned char header[225];
+    readAt(in, fileOffsets[fsid], header, sizeof(header));
+    BitInput ib(header, sizeof(header));
+    unsigned char prop = ib.read(7);
+    Mask mask;
+    mask.read(ib);
+    mask.versionId(std::min(arcVersion, 2));
+
+    size_t size = fileSizes[fsid];
+    std::vector<unsigned char> window(std::min(bufferSize, size));
+    std::string password;
+    bool hasPassword = false;
+
+    while (true) {
+        std::ofstream os(toPlatformPath(path), std::ios::binary);
+        MaskChain unmasker(mask, true, arcVersion >= 1 ? MASK_ROUNDS : 1);
+
+        ZSTD_DCtx* dctx = nullptr;
+        std::vector<unsigned char> out;
+        size_t frameLeft = 0;
+        if (prop & Conf::COMPRESSED) {
+            dctx = threadDCtx();
+            out.resize(ZSTD_DStreamOutSize());
+        }
+        auto sink = [&](const unsigned char* data, size_t len) {
+            if (!dctx) {
+                os.write((const char*) data, len);
+                return;
+            }
+            ZSTD_inBuffer zi = {data, len, 0};
+            while (zi.pos < zi.size) {
+                ZSTD_outBuffer zo = {out.data(), out.size(), 0};
+                frameLeft = ZSTD_decompressStream(dctx, &zo, &zi);
+                if (ZSTD_isError(frameLeft)) {
+                    dctx = nullptr;
+                    throw DArchiveException("Decompression failed: " + std::string(ZSTD_getErrorName(frameLeft)));
+                }
+                os.write((const char*) out.data(), zo.pos);
+            }
+        };
+
+        unsigned char head[4 + SALT_SIZE + IV_SIZE], tag[TAG_SIZE];
+        size_t headLen = 0, headSize = 4, cipherEnd = size;
+        unsigned int kix = 0;
+        bool keyed = false, gcm = false;
+        CBC_Mode<AES>::Decryption dec;
+        GCM<AES>::Decryption gdec;
+        std::string plain;
+        std::unique_ptr<StreamTransformationFilter> filter;
+
+        try {
+            size_t pos = 0;
+            while (pos < size) {
+                size_t len = std::min(window.size(), size - pos);
+                readAt(in, fileOffsets[fsid] + 225 + pos, window.data(), len);
+                size_t start = pos;
+                pos += len;
+                unmasker.feed(window.data(), len);
+                if (!(prop & Conf::ENCRYPTED)) {
+                    sink(window.data(), len);
+                    continue;
+                }
+                size_t skip = 0;
+                while (!keyed && skip < len) {
+                    size_t take = std::min(headSize - headLen, len - skip);
+                    std::memcpy(head + headLen, window.data() + skip, take);
+                    headLen += take;
+                    skip += take;
+                    if (headLen < headSize) continue;
+                    if (headSize == 4) {
+                        kix = LE::get(head, 4);
+                        gcm = schemeOf(kix) & KeyScheme::GCM;
+                        headSize = 4 + SALT_SIZE + (gcm ? GCM_IV_SIZE : IV_SIZE);
+                        if (gcm) {
+                            if (size < headSize + TAG_SIZE) throw DArchiveException("Invalid encrypted entry.");
+                            cipherEnd = size - TAG_SIZE;
+                        }
+                        continue;
+                    }
+                    if (!hasPassword) {
+                        password = passwordOf(kix);
+                        hasPassword = true;
+                    }
+                    SecByteBlock key(KEY_SIZE);
+                    entryKey(kix, password, head + 4, key);
+                    if (gcm) {
+                        gdec.SetKeyWithIV(key, key.size(), head + 4 + SALT_SIZE, GCM_IV_SIZE);
+                        gdec.Update(head, 4 + SALT_SIZE);
+                    }
+                    else {
+                        dec.SetKeyWithIV(key, key.size(), head + 4 + SALT_SIZE);
+                        filter.reset(new StreamTransformationFilter(dec, new StringSink(plain)));
+                    }
+                    keyed = true;
+                }
+                if (!keyed) continue;
+                if (gcm) {
+                    // The trailing tag bytes never reach the cipher.
+                    size_t body = std::min(len, std::max(cipherEnd, start + skip) - start);
+                    if (body > skip) {
+                        gdec.ProcessData(window.data() + skip, window.data() + skip, body - skip);
+                        sink(window.data() + skip, body - skip);
+                    }
+                    if (len > body) std::memcpy(tag + (start + body - cipherEnd), window.data() + body, len - body);
+                    continue;
+                }
+                filter->Put(window.data() + skip, len - skip);
+                sink((const unsigned char*) plain.data(), plain.size());
+                plain.clear();
+            }
+            if (prop & Conf::ENCRYPTED) {
+                if (!keyed) throw DArchiveException("Invalid encrypted entry.");
+                if (gcm) {
+                    if (!gdec.TruncatedVerify(tag, TAG_SIZE)) throw DArchiveException("Authentication failed.");
+                }
+                else {
+                    filter->MessageEnd();
+                    sink((const unsigned char*) plain.data(), plain.size());
+                }
+            }
+            if (dctx) {
+                dctx = nullptr;
+                if (frameLeft != 0) throw DArchiveException("Decompression failed: truncated frame.");
+            }
+            return;
+        }
+        catch (const std::exception& e) {
+            os.close();
+            // With a wrong key the garbage usually fails in zstd before the
+            // padding or tag is checked, so any failure after keying may be
+            // the key.
+            if (keyed && retryPassword(kix, password)) continue;
+            // The windows already written were never verified.
+            std::error_code ec;
+            std::filesystem::remove(toPlatformPath(path), ec);
+            if (!keyed) throw;
+            throw DArchiveException(std::string("Decryption failed: ") + e.what());
+        }
+    }
+}
+
+void DArchive::Extract(unsigned int fsid, std::filesystem::path path) {
+    extractNode(fsid, path, nullptr);
+    finishDownloads();
+}
+
 unsigned int DArchive::DumpFSID(std::filesystem::path path) {
     auto split = extract_segments(path);
     if (split.size() == 0) return 0xffffffff;
+
+    if (!pathIndex.empty()) {
+        std::string joined = split[0];
+        for (size_t k = 1; k < split.size(); k++) joined += "/" + split[k];
+        unsigned int hit = PathIndex::find(pathIndex, joined);
+        // A hash hit only counts once its parent chain spells the whole
+        // path; parents that aren't known yet fall back to the walk below.
+        std::lock_guard<std::recursive_mutex> lk(nodeLock);
+        unsigned int node = hit, top = hit;
+        size_t k = split.size();
+        while (node < fileCount && k > 0 && fileNames[node] == split[k - 1]) {
+            k--;
+            top = node;
+            node = nodes[node].parent;
+        }
+        if (k == 0 && node == 0xffffffff && (peekProp(top) & Conf::ROOTDIR)) return hit;
+    }
     
     unsigned int fsid = 0;
     bool found = false;
@@ -452,48 +1597,15 @@ unsigned int DArchive::DumpFSID(std::filesystem::path path) {
 
     for (unsigned int k = 1; k < split.size(); k++) {
         found = false;
-        unsigned char prop;
-        auto [size, data] = extractData(fsid, prop);
-        if (!good) return 0xffffffff;
-        while (prop & Conf::SYMLINK) {
-            unsigned int nfsid = 0;
-            if (size != 4) {
-                delete[] data;
-                return 0xffffffff;
-            }
-            for (unsigned int i = 0; i < 4; i++) {
-                nfsid |= (((unsigned int) data[i]) << (i << 3));
-            }
-            delete[] data;
-            auto[nsize, ndata] = extractData(nfsid, prop);
-            if (!good) return 0xffffffff;
-            size = nsize;
-            data = ndata;
-        }
-        if (!(prop & Conf::PATH)) {
-            delete[] data;
-            return 0xffffffff;
-        }
-        unsigned int count = 0, nfsid;
-        for (unsigned int i = 0; i < 4; i++) {
-            count |= (((unsigned int) data[i]) << (i << 3));
-        }
-        for (unsigned int i = 0; i < count; i++) {
-            nfsid = 0;
-            for (unsigned int j = 0; j < 4; j++) {
-                nfsid |= (((unsigned int) data[(i + 1) * 4 + j]) << (j << 3));
-            }
-            if (nfsid >= fileCount) {
-                delete[] data;
-                return 0xffffffff;
-            }
-            if (fileNames[nfsid] == split[k]) {
-                fsid = nfsid;
+        const NodeInfo* node = resolveNode(fsid);
+        if (!node || !(node->prop & Conf::PATH)) return 0xffffffff;
+        for (auto child : node->children) {
+            if (fileNames[child] == split[k]) {
+                fsid = child;
                 found = true;
                 break;
             }
         }
-        delete[] data;
         if (!found) return 0xffffffff;
     }
     return fsid;
@@ -509,16 +1621,33 @@ void DArchive::PostExtract() {
         return std::get<0>(a) > std::get<0>(b);
     });
     for (auto[pri, src, title] : tasks) {
-        std::cout << "Execute  " << src << std::endl;
-        RunPostScript(src, title);
+        if (!quiet) std::cout << "Execute  " << src << std::endl;
+        runScript(src, title);
     }
 }
 
+// Scripts reach the archive they come from through g_arch.
+void DArchive::runScript(const std::string& src, const std::string& title) {
+    g_arch = this;
+    RunPostScript(src, title);
+}
+
 void DArchive::ExtractAll() {
+    if (threads > 1) {
+        ExtractPool pool(*this, threads);
+        for (auto x : rootdir) {
+            extractNode(x, std::filesystem::u8path(fileNames[x]), &pool);
+            if (!good) break;
+        }
+        pool.wait();
+        finishDownloads();
+        return;
+    }
     for (auto x : rootdir) {
-        Extract(x, std::filesystem::u8path(fileNames[x]));
-        if (!good) return;
+        extractNode(x, std::filesystem::u8path(fileNames[x]), nullptr);
+        if (!good) break;
     }
+    finishDownloads();
 }
 
 void DArchive::Safe() { safeMode = true; }
@@ -528,105 +1657,99 @@ void DArchive::AddRoutine(unsigned int fsid, std::filesystem::path path) {
 }
 
 void DArchive::RunRoutines() {
+    if (threads > 1) {
+        ExtractPool pool(*this, threads);
+        while (!routines.empty()) {
+            auto[fsid, path] = routines.front();
+            routines.pop();
+            extractNode(fsid, path, &pool);
+        }
+        pool.wait();
+        finishDownloads();
+        return;
+    }
     while (!routines.empty()) {
         auto[fsid, path] = routines.front();
         routines.pop();
-        Extract(fsid, path);
+        extractNode(fsid, path, nullptr);
     }
+    finishDownloads();
+}
+
+void DArchive::SetBufferSize(size_t size) {
+    bufferSize = size ? size : 1;
+}
+
+void DArchive::SetConnections(unsigned int count) {
+    connections = count ? count : 1;
+}
+
+void DArchive::SetThreads(unsigned int count) {
+    if (count == 0) count = std::thread::hardware_concurrency();
+    threads = count ? count : 1;
 }
 
 bool DArchive::isDirectory(unsigned int fsid) {
-    if (fsid >= fileCount) return false;
-    unsigned char prop;
-    auto [size, data] = extractData(fsid, prop);
-    if (!good) return false;
-    while (prop & Conf::SYMLINK) {
-        unsigned int nfsid = 0;
-        if (size != 4) {
-            delete[] data;
-            return false;
-        }
-        for (unsigned int i = 0; i < 4; i++) {
-            nfsid |= (((unsigned int) data[i]) << (i << 3));
-        }
-        delete[] data;
-        if (nfsid >= fileCount) return false;
-        auto[nsize, ndata] = extractData(nfsid, prop);
-        if (!good) return false;
-        size = nsize;
-        data = ndata;
-    }
-    delete[] data;
-    return prop & Conf::PATH;
+    const NodeInfo* node = resolveNode(fsid);
+    return node && (node->prop & Conf::PATH);
 }
 
 bool DArchive::isSymlink(unsigned int fsid) {
     if (fsid >= fileCount) return false;
-    is.seekg(fileOffsets[fsid], std::ios::beg);
-    
-    BitInput ib(is);
-    unsigned char prop = ib.read(7);
+    return peekProp(fsid) & Conf::SYMLINK;
+}
 
-    return prop & Conf::SYMLINK;
+// The entry a chain of symlinks ends at; other entries are their own.
+unsigned int DArchive::resolveLink(unsigned int fsid) {
+    const NodeInfo* node = resolveNode(fsid);
+    return node ? node - nodes.data() : 0xffffffff;
 }
 
 std::vector<unsigned int> DArchive::listDirectory(int fsid) {
     if (fsid < 0 || fsid >= fileCount) return rootdir;
 
-    unsigned char prop;
-    auto [size, data] = extractData(fsid, prop);
-    if (!good) return {};
-    while (prop & Conf::SYMLINK) {
-        int nfsid = 0;
-        if (size != 4) {
-            delete[] data;
-            return {};
-        }
-        for (unsigned int i = 0; i < 4; i++) {
-            nfsid |= (((int) data[i]) << (i << 3));
-        }
-        delete[] data;
-        if (nfsid >= fileCount) return {};
-        auto[nsize, ndata] = extractData(nfsid, prop);
-        if (!good) return {};
-        size = nsize;
-        data = ndata;
-    }
-    if (prop & Conf::PATH) {
-        std::vector<unsigned int> res;
-        unsigned int count = 0, nfsid;
-        for (unsigned int i = 0; i < 4; i++) {
-            count |= (((unsigned int) data[i]) << (i << 3));
-        }
-        for (unsigned int i = 0; i < count; i++) {
-            nfsid = 0;
-            for (unsigned int j = 0; j < 4; j++) {
-                nfsid |= (((unsigned int) data[(i + 1) * 4 + j]) << (j << 3));
-            }
-            if (nfsid < fileCount) res.push_back(nfsid);
-        }
-        delete[] data;
-        return res;
-    }
-    else {
-        delete[] data;
-        return {};
-    }
+    const NodeInfo* node = resolveNode(fsid);
+    if (!node || !(node->prop & Conf::PATH)) return {};
+    return node->children;
 }
 
 std::string DArchive::getName(unsigned int fsid) {
     if (fsid >= fileCount) return "**undefined**";
-    return fileNames[fsid];
+    return std::string(fileNames[fsid]);
+}
+
+// Size before compression and encryption. Archives without a node table
+// don't record it, so such entries are decoded once to learn it.
+unsigned long long DArchive::getSize(unsigned int fsid) {
+    if (fsid >= fileCount) return 0;
+    unsigned int source = payloadOf(fsid);
+    {
+        std::lock_guard<std::recursive_mutex> lk(nodeLock);
+        if (nodes[fsid].rawSize != (unsigned long long) -1) return nodes[fsid].rawSize;
+        if (!(peekProp(source) & (Conf::COMPRESSED | Conf::ENCRYPTED))) return fileSizes[source];
+    }
+    auto [size, data] = cachedEntry(source);
+    if (!data) throw DArchiveException("Unable to decode the entry.");
+    std::lock_guard<std::recursive_mutex> lk(nodeLock);
+    nodes[fsid].rawSize = size;
+    return size;
 }
 
 unsigned int DArchive::FSCount() { return fileCount; }
 
-DArchive::DArchive(std::string name) {
+DArchive::DArchive(std::string name, bool quiet) : quiet(quiet) {
     curlState = false;
+    ddict = nullptr;
+    entryCached = 0;
     good = true;
     fileCount = 0;
     safeMode = false;
+    threads = 1;
+    connections = DOWNLOAD_CONNECTIONS;
+    bufferSize = STREAM_BUFFER_SIZE;
+    archiveName = name;
     is.open(toPlatformPath(name), std::ios::binary);
+    map.open(toPlatformPath(name));
     unsigned char header[16];
     is.read((char*) header, 16);
     if (std::string((char*) header, 4) != "MKAR") {
@@ -634,12 +1757,12 @@ DArchive::DArchive(std::string name) {
     }
     unsigned short impl = (((unsigned short) header[5]) << 8) | header[4];
     unsigned short ver = (((unsigned short) header[7]) << 8) | header[6];
-    std::cout << "Implementation: " << impl << "\nStandard Version: " << ver << std::endl;
+    if (!quiet) std::cout << "Implementation: " << impl << "\nStandard Version: " << ver << std::endl;
     arcVersion = ver;
     if (impl != 0x2009) {
         throw DArchiveException("Incompatible implementation.");
     }
-    if (ver > 2) {
+    if (ver > 7) {
         throw DArchiveException("Incompatible standard version.");
     }
 
@@ -648,10 +1771,13 @@ DArchive::DArchive(std::string name) {
         fstOffset |= (((unsigned long long) header[i + 8]) << (i << 3));
     }
 
-    std::cout << "Offset: " << fstOffset << std::endl;
+    if (!quiet) std::cout << "Offset: " << fstOffset << std::endl;
 }
 
 DArchive::~DArchive() {
+    downloads.reset();
     if (curlState) curl_global_cleanup();
+    if (ddict) ZSTD_freeDDict(ddict);
+    map.close();
     is.close();
 }
@@ -2,18 +2,34 @@
 #include "conf.hpp"
 #include "mask.hpp"
 #include "platform.hpp"
+#include "bytes.hpp"
+#include "path_index.hpp"
+#include "darchive.hpp"
 #include <zstd.h>
+#include <zdict.h>
 #include <cryptopp/cryptlib.h>
 #include <cryptopp/aes.h>
 #include <cryptopp/filters.h>
 #include <cryptopp/modes.h>
+#include <cryptopp/gcm.h>
 #include <cryptopp/sha.h>
+#include <cryptopp/blake2.h>
 #include <cryptopp/pwdbased.h>
+#include <cryptopp/hkdf.h>
 #include <cryptopp/osrng.h>
 #include <cryptopp/hex.h>
 #include <cryptopp/secblock.h>
 #include <cstring>
 #include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+#include <chrono>
 
 class EArchiveException : public std::exception {
 private:
@@ -27,10 +43,39 @@ public:
     }
 };
 
-std::pair<size_t, unsigned char*> EArchive::compress_data(const unsigned char* in, size_t len) {
+// Each packing thread keeps one compression context; threadCCtx() resets
+// it to the archive's parameters. A CDict overrides the requested level
+// with its own, so every level in use gets a CDict of its own.
+struct CCtxHolder {
+    ZSTD_CCtx* ctx = ZSTD_createCCtx();
+    ~CCtxHolder() { ZSTD_freeCCtx(ctx); }
+};
+
+ZSTD_CCtx_s* EArchive::threadCCtx(int level, bool useDict) const {
+    thread_local CCtxHolder holder;
+    ZSTD_CCtx* cctx = holder.ctx;
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+    size_t err = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+    if (!ZSTD_isError(err)) err = ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, longMatching);
+    if (!ZSTD_isError(err) && windowLog) err = ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, windowLog);
+    if (ZSTD_isError(err)) {
+        throw EArchiveException("Invalid compression parameters: " + std::string(ZSTD_getErrorName(err)));
+    }
+    // Fails harmlessly when zstd is built without multithreading.
+    if (zstdWorkers) ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, zstdWorkers);
+    if (!useDict) return cctx;
+    if (level == this->level && cdict) ZSTD_CCtx_refCDict(cctx, cdict);
+    else if (level == ADAPTIVE_FAST_LEVEL && fastCDict) ZSTD_CCtx_refCDict(cctx, fastCDict);
+    else if (!dict.empty()) throw EArchiveException("No dictionary for compression level " + std::to_string(level) + ".");
+    return cctx;
+}
+
+std::pair<size_t, unsigned char*> EArchive::compress_data(const unsigned char* in, size_t len, int level, bool useDict) const {
     size_t compressBound = ZSTD_compressBound(len);
     unsigned char* out = new unsigned char[compressBound];
-    size_t compressedSize = ZSTD_compress(out, compressBound, in, len, 11);
+    auto start = std::chrono::steady_clock::now();
+    size_t compressedSize = ZSTD_compress2(threadCCtx(level, useDict), out, compressBound, in, len);
+    stats.nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
 
     if (ZSTD_isError(compressedSize)) {
         delete[] out;
@@ -42,30 +87,104 @@ std::pair<size_t, unsigned char*> EArchive::compress_data(const unsigned char* i
 
 using namespace CryptoPP;
 
-std::pair<size_t, unsigned char*> EArchive::encrypt_data(const unsigned char* in, size_t len, unsigned int kix) {
+static void derive_key(const std::string& password, const byte* salt, byte* key, size_t len) {
+    PKCS5_PBKDF2_HMAC<SHA256> pbkdf;
+    pbkdf.DeriveKey(
+        key, len,
+        0,
+        (byte*)password.data(), password.size(),
+        salt, SALT_SIZE,
+        PBKDF2_ITERATIONS
+    );
+}
+
+std::string EArchive::passwordOf(unsigned int kix) const {
     auto it = keys.find(kix);
-    std::string password;
-    if (it != keys.end()) {
-        password = it->second;
+    if (it == keys.end()) throw EArchiveException("Missing password for key index: " + std::to_string(kix));
+    return it->second;
+}
+
+// With KeyScheme::DERIVED the expensive PBKDF2 runs once per key index
+// against an archive-wide salt; each entry key is then an HKDF of that
+// master key and the entry salt.
+void EArchive::entryKey(unsigned int kix, const unsigned char* salt, unsigned char* key) const {
+    std::string password = passwordOf(kix);
+    if (!(keyScheme & KeyScheme::DERIVED)) {
+        if (keyScheme) {
+            // Still record the scheme of this key index for the reader.
+            std::lock_guard<std::mutex> lk(keyLock);
+            keySalts.insert({kix, std::vector<unsigned char>(SALT_SIZE)});
+        }
+        derive_key(password, salt, key, KEY_SIZE);
+        return;
+    }
+
+    std::vector<unsigned char> master;
+    {
+        std::lock_guard<std::mutex> lk(keyLock);
+        auto it = masterKeys.find(kix);
+        if (it == masterKeys.end()) {
+            // An updated archive keeps the salt its older entries used.
+            std::vector<unsigned char> arcSalt(SALT_SIZE), mkey(MASTER_KEY_SIZE);
+            auto known = keySalts.find(kix);
+            if (known != keySalts.end()) arcSalt = known->second;
+            else {
+                AutoSeededRandomPool rng;
+                rng.GenerateBlock(arcSalt.data(), arcSalt.size());
+            }
+            derive_key(password, arcSalt.data(), mkey.data(), mkey.size());
+            keySalts[kix] = arcSalt;
+            it = masterKeys.insert({kix, mkey}).first;
+        }
+        master = it->second;
     }
-    else throw EArchiveException("Missing password for key index: " + std::to_string(kix));
+
+    HKDF<SHA256> hkdf;
+    hkdf.DeriveKey(key, KEY_SIZE, master.data(), master.size(), salt, SALT_SIZE, (const byte*) ENTRY_KEY_INFO, sizeof(ENTRY_KEY_INFO) - 1);
+}
+
+// Writes [kix][salt][iv][cipher][tag] straight into the output buffer,
+// authenticating kix and salt as associated data. A salt and key given by
+// the caller are used instead of fresh ones.
+std::pair<size_t, unsigned char*> EArchive::encrypt_gcm(const unsigned char* in, size_t len, unsigned int kix, const unsigned char* entrySalt, const unsigned char* entryKey) const {
+    AutoSeededRandomPool rng;
+
+    size_t headSize = 4 + SALT_SIZE + GCM_IV_SIZE;
+    unsigned char* out = new unsigned char[headSize + len + TAG_SIZE];
+    for (size_t i = 0; i < 4; i++) {
+        out[i] = (kix >> (i << 3)) & 0xff;
+    }
+    byte* salt = out + 4;
+    byte* iv = out + 4 + SALT_SIZE;
+    if (entrySalt) std::memcpy(salt, entrySalt, SALT_SIZE);
+    else rng.GenerateBlock(salt, SALT_SIZE);
+    rng.GenerateBlock(iv, GCM_IV_SIZE);
+
+    SecByteBlock key(KEY_SIZE);
+    if (entryKey) std::memcpy(key, entryKey, KEY_SIZE);
+    else this->entryKey(kix, salt, key);
+
+    GCM<AES>::Encryption enc;
+    enc.SetKeyWithIV(key, key.size(), iv, GCM_IV_SIZE);
+    enc.EncryptAndAuthenticate(out + headSize, out + headSize + len, TAG_SIZE, iv, GCM_IV_SIZE, out, 4 + SALT_SIZE, in, len);
+
+    return {headSize + len + TAG_SIZE, out};
+}
+
+std::pair<size_t, unsigned char*> EArchive::encrypt_data(const unsigned char* in, size_t len, unsigned int kix, const unsigned char* entrySalt, const unsigned char* entryKey) const {
+    if (keyScheme & KeyScheme::GCM) return encrypt_gcm(in, len, kix, entrySalt, entryKey);
 
     AutoSeededRandomPool rng;
 
     byte salt[SALT_SIZE];
     byte iv[IV_SIZE];
-    rng.GenerateBlock(salt, sizeof(salt));
+    if (entrySalt) std::memcpy(salt, entrySalt, SALT_SIZE);
+    else rng.GenerateBlock(salt, sizeof(salt));
     rng.GenerateBlock(iv, sizeof(iv));
 
     SecByteBlock key(KEY_SIZE);
-    PKCS5_PBKDF2_HMAC<SHA256> pbkdf;
-    pbkdf.DeriveKey(
-        key, key.size(),
-        0,
-        (byte*)password.data(), password.size(),
-        salt, sizeof(salt),
-        PBKDF2_ITERATIONS
-    );
+    if (entryKey) std::memcpy(key, entryKey, KEY_SIZE);
+    else this->entryKey(kix, salt, key);
 
     CBC_Mode<AES>::Encryption enc;
     enc.SetKeyWithIV(key, key.size(), iv);
@@ -90,19 +209,122 @@ std::pair<size_t, unsigned char*> EArchive::encrypt_data(const unsigned char* in
     return {totalSize + 4, out};
 }
 
-void EArchive::AddPath(std::filesystem::path path, unsigned int fsid) {
-    std::error_code ec;
+// One frame of a seekable entry, compressed, encrypted and masked so that
+// it decodes without the frames before it. All frames of an entry share
+// one salt and key, so the key is derived once per entry, and a reader
+// seeking through the frames derives it once as well.
+std::pair<size_t, unsigned char*> EArchive::encodeFrame(const unsigned char* in, size_t len, unsigned char prop, unsigned int kix, const unsigned char* salt, const unsigned char* key, int level, Mask& mask) const {
+    std::pair<size_t, unsigned char*> frame;
+    if (prop & Conf::COMPRESSED) frame = compress_data(in, len, level);
+    else {
+        frame = {len, new unsigned char[len]};
+        std::memcpy(frame.second, in, len);
+    }
+    if (prop & Conf::ENCRYPTED) {
+        auto cipher = encrypt_data(frame.second, frame.first, kix, salt, key);
+        delete[] frame.second;
+        if (!cipher.second) return {0, nullptr};
+        frame = cipher;
+    }
+    mask.mask(frame.second, frame.first, MASK_ROUNDS);
+    return frame;
+}
+
+unsigned char EArchive::propOf(const std::filesystem::path& path) const {
     unsigned char prop = 0;
     auto it = props.find(path.lexically_normal().generic_u8string());
     if (it != props.end()) prop = it->second;
-    prop |= maskProp;
+    return prop | maskProp;
+}
 
+unsigned int EArchive::kixOf(const std::filesystem::path& path) const {
+    auto it = enckix.find(path.lexically_normal().generic_u8string());
+    if (it == enckix.end()) return 0;
+    return it->second;
+}
+
+// Decides whether to store an entry or compress it at the fast or the
+// archive level, judged by how well its head compresses at the fast level.
+// The probe leaves the dictionary out so it stays fast.
+EArchive::Choice EArchive::chooseLevel(const unsigned char* sample, size_t len) const {
+    auto[size, out] = compress_data(sample, len, ADAPTIVE_FAST_LEVEL, false);
+    delete[] out;
+    double ratio = (double) size / len;
+    if (ratio >= ADAPTIVE_STORE_RATIO) return Choice::STORE;
+    return ratio < ADAPTIVE_HIGH_RATIO ? Choice::HIGH : Choice::FAST;
+}
+
+std::string EArchive::payloadKey(unsigned char prop, const std::filesystem::path& path, const unsigned char* data, size_t len) const {
+    BLAKE2b hash(false, 32);
+    hash.Update(data, len);
+    std::string digest(hash.DigestSize(), 0);
+    hash.Final((unsigned char*) digest.data());
+    return payloadKey(prop, path, digest);
+}
+
+// Entries are only shared between files with the same prop bits and key
+// index, so a reference never changes how its payload is protected.
+std::string EArchive::payloadKey(unsigned char prop, const std::filesystem::path& path, const std::string& digest) const {
+    std::string key(5, 0);
+    key[0] = prop;
+    unsigned int kix = kixOf(path);
+    for (size_t i = 0; i < 4; i++) key[1 + i] = (kix >> (i << 3)) & 0xff;
+    return key + digest;
+}
+
+unsigned int EArchive::storedPayload(const std::string& key) const {
+    std::lock_guard<std::mutex> lk(dedupLock);
+    auto it = payloads.find(key);
+    return it == payloads.end() ? 0xffffffff : it->second;
+}
+
+// A reference carries the prop of the entry it points to, which adaptive
+// compression may have changed from the one asked for.
+void EArchive::writeReference(const std::filesystem::path& path, size_t rawSize, unsigned int source) {
+    closeBlock();
+    std::cout << "Link " << path.lexically_normal().generic_u8string() << std::endl;
     Mask mask;
-    BitOutput ob(os);
-    
+    std::string header = entryHeader(fileProps[source], mask);
+    os.write(header.data(), header.size());
+    dedupRefs.push_back({(unsigned int) fileNames.size(), source});
+    fileNames.push_back((path.has_filename() ? path : path.parent_path()).filename().u8string());
+    fileOffsets.push_back(prevSize);
+    fileProps.push_back(fileProps[source]);
+    fileSizes.push_back(0);
+    rawSizes.push_back(rawSize);
+    prevSize += header.size();
+}
+
+std::string EArchive::entryHeader(unsigned char prop, Mask& mask) const {
+    unsigned char header[225];
+    BitOutput ob(header, sizeof(header));
     ob.write(prop, 7);
     mask.write(ob);
+    return std::string((const char*) header, ob.finish());
+}
+
+bool EArchive::packPath(const std::filesystem::path& path, unsigned int fsid, PackedEntry& entry) const {
+    std::error_code ec;
+    unsigned char prop = propOf(path);
+
+    entry.content = nullptr;
+    entry.size = entry.rawSize = 0;
+    entry.prop = prop;
+    entry.source = 0xffffffff;
+    entry.ok = false;
+    entry.streamed = entry.solid = false;
 
+    // Large plain files are streamed by the writer instead of being loaded.
+    if (!(prop & (Conf::PATH | Conf::SYMLINK | Conf::SCRIPT))) {
+        size_t size = std::filesystem::file_size(toPlatformPath(path), ec);
+        if (ec) return false;
+        if (size > bufferSize) {
+            entry.ok = entry.streamed = true;
+            return true;
+        }
+    }
+
+    Mask mask;
     unsigned char* content;
     size_t fsize;
 
@@ -122,31 +344,25 @@ void EArchive::AddPath(std::filesystem::path path, unsigned int fsid) {
     }
     else {
         size_t size = std::filesystem::file_size(toPlatformPath(path), ec);
-        if (ec) {
-            good = false;
-            return;
-        }
+        if (ec) return false;
         if (prop & Conf::SCRIPT) content = new unsigned char[size + 4];
         else content = new unsigned char[size];
         std::ifstream file(toPlatformPath(path), std::ios::binary);
         if (!file) {
-            good = false;
             delete[] content;
-            return;
+            return false;
         }
         if (!file.read((char*) (content + ((prop & Conf::SCRIPT) ? 4 : 0)), size)) {
-            good = false;
             delete[] content;
-            return;
+            return false;
         }
         fsize = size + ((prop & Conf::SCRIPT) ? 4 : 0);
 
         if (prop & Conf::SCRIPT) {
             auto it = execpri.find(path.lexically_normal().generic_u8string());
             if (it == execpri.end()) {
-                good = false;
                 delete[] content;
-                return;
+                return false;
             }
             unsigned int pri = it->second;
             for (size_t j = 0; j < 4; j++) {
@@ -172,43 +388,379 @@ void EArchive::AddPath(std::filesystem::path path, unsigned int fsid) {
         }
     }
 
-    if (prop & Conf::COMPRESSED) {
-        auto[nfsize, ncontent] = compress_data(content, fsize);
+    entry.rawSize = fsize;
+
+    // Identical files already written become references. writeEntry checks
+    // again, since in parallel runs the first copy may still be in flight.
+    if (dedup && !(prop & (Conf::PATH | Conf::SYMLINK | Conf::SCRIPT))) {
+        entry.digest = payloadKey(prop, path, content, fsize);
+        entry.source = storedPayload(entry.digest);
+        if (entry.source != 0xffffffff) {
+            delete[] content;
+            entry.ok = true;
+            return true;
+        }
+    }
+
+    // Large files become seekable: frames encoded one after another.
+    if (frameSize && fsize > frameSize && !(prop & (Conf::PATH | Conf::SYMLINK | Conf::SCRIPT))) {
+        entry.header = entryHeader(prop, mask);
+        unsigned char frameSalt[SALT_SIZE];
+        SecByteBlock frameKey(KEY_SIZE);
+        if (prop & Conf::ENCRYPTED) {
+            AutoSeededRandomPool().GenerateBlock(frameSalt, SALT_SIZE);
+            entryKey(kixOf(path), frameSalt, frameKey);
+        }
+        std::vector<unsigned char> payload;
+        for (size_t pos = 0; pos < fsize; pos += frameSize) {
+            auto [len, frame] = encodeFrame(content + pos, std::min(frameSize, fsize - pos), prop, kixOf(path), frameSalt, frameKey, level, mask);
+            if (!frame) {
+                delete[] content;
+                return false;
+            }
+            payload.insert(payload.end(), frame, frame + len);
+            entry.frames.push_back(payload.size());
+            delete[] frame;
+        }
         delete[] content;
+        if (prop & Conf::COMPRESSED) {
+            stats.rawBytes += fsize;
+            stats.packedBytes += payload.size();
+        }
+        entry.content = new unsigned char[payload.size()];
+        std::memcpy(entry.content, payload.data(), payload.size());
+        entry.size = payload.size();
+        entry.ok = true;
+        return true;
+    }
+
+    // Small compressed entries are compressed together in solid blocks.
+    if (solidSize && (prop & Conf::COMPRESSED) && !(prop & Conf::ENCRYPTED) && fsize <= solidSize) {
+        entry.header = entryHeader(prop, mask);
+        entry.content = content;
+        entry.size = fsize;
+        entry.ok = entry.solid = true;
+        return true;
+    }
+
+    // Only files with content are probed; directories, links and empty
+    // files keep the archive level and stay out of the stats.
+    int entryLevel = level;
+    bool probed = adaptive && fsize && (prop & Conf::COMPRESSED) && !(prop & (Conf::PATH | Conf::SYMLINK));
+    Choice choice = Choice::HIGH;
+    if (probed) {
+        choice = chooseLevel(content, std::min(fsize, ADAPTIVE_SAMPLE_SIZE));
+        if (choice == Choice::STORE) prop &= ~Conf::COMPRESSED;
+        if (choice == Choice::FAST) entryLevel = ADAPTIVE_FAST_LEVEL;
+    }
+
+    if (prop & Conf::COMPRESSED) {
+        auto[nfsize, ncontent] = compress_data(content, fsize, entryLevel);
         if (ncontent == nullptr) {
-            good = false;
-            return;
+            delete[] content;
+            return false;
+        }
+        if (adaptive && nfsize >= fsize) {
+            delete[] ncontent;
+            prop &= ~Conf::COMPRESSED;
+        }
+        else {
+            delete[] content;
+            content = ncontent;
+            fsize = nfsize;
         }
-        content = ncontent;
-        fsize = nfsize;
     }
+    if (probed) {
+        if (!(prop & Conf::COMPRESSED)) stats.stored++;
+        else (choice == Choice::FAST ? stats.fast : stats.high)++;
+    }
+    if (entry.prop & Conf::COMPRESSED) {
+        stats.rawBytes += entry.rawSize;
+        stats.packedBytes += fsize;
+    }
+    entry.prop = prop;
+    entry.header = entryHeader(prop, mask);
 
     if (prop & Conf::ENCRYPTED) {
-        auto it = enckix.find(path.lexically_normal().generic_u8string());
-        unsigned int kix;
-        if (it == enckix.end()) kix = 0;
-        else kix = it->second;
-        auto[nfsize, ncontent] = encrypt_data(content, fsize, kix);
+        auto[nfsize, ncontent] = encrypt_data(content, fsize, kixOf(path));
         delete[] content;
-        if (ncontent == nullptr) {
-            good = false;
-            return;
-        }
+        if (ncontent == nullptr) return false;
         content = ncontent;
         fsize = nfsize;
     }
 
+    mask.mask(content, fsize, MASK_ROUNDS);
+
+    entry.content = content;
+    entry.size = fsize;
+    entry.ok = true;
+    return true;
+}
+
+void EArchive::writeEntry(const std::filesystem::path& path, PackedEntry& entry) {
+    if (!entry.digest.empty()) {
+        if (entry.source == 0xffffffff) entry.source = storedPayload(entry.digest);
+        if (entry.source != 0xffffffff) {
+            delete[] entry.content;
+            entry.content = nullptr;
+            writeReference(path, entry.rawSize, entry.source);
+            return;
+        }
+        std::lock_guard<std::mutex> lk(dedupLock);
+        payloads[entry.digest] = fileNames.size();
+    }
     std::cout << "Add " << path.lexically_normal().generic_u8string() << std::endl;
-    mask.mask(content, fsize);
-    mask.mask(content, fsize);
-    mask.mask(content, fsize);
-    os.write((const char*) content, fsize);
+    if (entry.solid) {
+        fileNames.push_back((path.has_filename() ? path : path.parent_path()).filename().u8string());
+        addToBlock(entry);
+        return;
+    }
+    closeBlock();
+    os.write(entry.header.data(), entry.header.size());
+    os.write((const char*) entry.content, entry.size);
+    if (!entry.frames.empty()) frameRefs.push_back({fileNames.size(), frameSize, entry.frames});
 
     fileNames.push_back((path.has_filename() ? path : path.parent_path()).filename().u8string());
     fileOffsets.push_back(prevSize);
-    prevSize += 225 + fsize;
+    fileProps.push_back(entry.prop);
+    fileSizes.push_back(entry.size);
+    rawSizes.push_back(entry.rawSize);
+    prevSize += entry.header.size() + entry.size;
 
-    delete[] content;
+    delete[] entry.content;
+    entry.content = nullptr;
+}
+
+// Encodes a file through fixed windows of bufferSize bytes: read, zstd
+// stream, cipher, then the fused mask passes, writing as it goes. With
+// dedup a first pass hashes the same windows, so a duplicate is written
+// as a reference without being encoded.
+bool EArchive::streamPath(const std::filesystem::path& path) {
+    unsigned char prop = propOf(path);
+    std::error_code ec;
+    size_t size = std::filesystem::file_size(toPlatformPath(path), ec);
+    if (ec) return false;
+    std::ifstream file(toPlatformPath(path), std::ios::binary);
+    if (!file) return false;
+
+    std::string key;
+    if (dedup) {
+        BLAKE2b hash(false, 32);
+        std::vector<unsigned char> window(std::min(bufferSize, size));
+        for (size_t pos = 0; pos < size; pos += window.size()) {
+            size_t len = std::min(window.size(), size - pos);
+            if (!file.read((char*) window.data(), len)) return false;
+            hash.Update(window.data(), len);
+        }
+        std::string digest(hash.DigestSize(), 0);
+        hash.Final((unsigned char*) digest.data());
+        key = payloadKey(prop, path, digest);
+        unsigned int source = storedPayload(key);
+        if (source != 0xffffffff) {
+            writeReference(path, size, source);
+            return true;
+        }
+        file.seekg(0, std::ios::beg);
+    }
+
+    int entryLevel = level;
+    bool compressed = prop & Conf::COMPRESSED;
+    if (adaptive && compressed) {
+        std::vector<unsigned char> sample(std::min(size, ADAPTIVE_SAMPLE_SIZE));
+        if (!file.read((char*) sample.data(), sample.size())) return false;
+        file.seekg(0, std::ios::beg);
+        Choice choice = chooseLevel(sample.data(), sample.size());
+        if (choice == Choice::STORE) {
+            prop &= ~Conf::COMPRESSED;
+            stats.stored++;
+        }
+        else if (choice == Choice::FAST) {
+            entryLevel = ADAPTIVE_FAST_LEVEL;
+            stats.fast++;
+        }
+        else stats.high++;
+    }
+
+    Mask mask;
+    std::string header = entryHeader(prop, mask);
+
+    closeBlock();
+    std::cout << "Add " << path.lexically_normal().generic_u8string() << std::endl;
+    os.write(header.data(), header.size());
+    // Part of the entry is already out; rewind so nothing points at it.
+    auto abandon = [&]() {
+        os.seekp(prevSize, std::ios::beg);
+        return false;
+    };
+
+    if (frameSize && size > frameSize) {
+        std::vector<unsigned char> window(frameSize);
+        std::vector<unsigned long long> frames;
+        size_t written = 0;
+        unsigned char frameSalt[SALT_SIZE];
+        SecByteBlock frameKey(KEY_SIZE);
+        if (prop & Conf::ENCRYPTED) {
+            AutoSeededRandomPool().GenerateBlock(frameSalt, SALT_SIZE);
+            entryKey(kixOf(path), frameSalt, frameKey);
+        }
+        for (size_t pos = 0; pos < size; pos += frameSize) {
+            size_t len = std::min(frameSize, size - pos);
+            if (!file.read((char*) window.data(), len)) return abandon();
+            auto [flen, frame] = encodeFrame(window.data(), len, prop, kixOf(path), frameSalt, frameKey, entryLevel, mask);
+            if (!frame) return abandon();
+            os.write((const char*) frame, flen);
+            delete[] frame;
+            written += flen;
+            frames.push_back(written);
+        }
+        if (compressed) {
+            stats.rawBytes += size;
+            stats.packedBytes += written;
+        }
+        if (!key.empty()) {
+            std::lock_guard<std::mutex> lk(dedupLock);
+            payloads[key] = fileNames.size();
+        }
+        frameRefs.push_back({fileNames.size(), frameSize, frames});
+        fileNames.push_back((path.has_filename() ? path : path.parent_path()).filename().u8string());
+        fileOffsets.push_back(prevSize);
+        fileProps.push_back(prop);
+        fileSizes.push_back(written);
+        rawSizes.push_back(size);
+        prevSize += header.size() + written;
+        return true;
+    }
+
+    MaskChain masker(mask, false, MASK_ROUNDS);
+    size_t written = 0;
+    auto emit = [&](unsigned char* data, size_t len) {
+        masker.feed(data, len);
+        os.write((const char*) data, len);
+        written += len;
+    };
+
+    CBC_Mode<AES>::Encryption enc;
+    GCM<AES>::Encryption genc;
+    bool gcm = (prop & Conf::ENCRYPTED) && (keyScheme & KeyScheme::GCM);
+    std::string cipher;
+    std::unique_ptr<StreamTransformationFilter> filter;
+    if (prop & Conf::ENCRYPTED) {
+        unsigned int kix = kixOf(path);
+        size_t ivSize = gcm ? GCM_IV_SIZE : IV_SIZE;
+
+        AutoSeededRandomPool rng;
+        unsigned char head[4 + SALT_SIZE + IV_SIZE];
+        for (size_t i = 0; i < 4; i++) {
+            head[i] = (kix >> (i << 3)) & 0xff;
+        }
+        rng.GenerateBlock(head + 4, SALT_SIZE);
+        rng.GenerateBlock(head + 4 + SALT_SIZE, ivSize);
+
+        SecByteBlock key(KEY_SIZE);
+        entryKey(kix, head + 4, key);
+        if (gcm) {
+            genc.SetKeyWithIV(key, key.size(), head + 4 + SALT_SIZE, GCM_IV_SIZE);
+            genc.Update(head, 4 + SALT_SIZE);
+        }
+        else {
+            enc.SetKeyWithIV(key, key.size(), head + 4 + SALT_SIZE);
+            filter.reset(new StreamTransformationFilter(enc, new StringSink(cipher)));
+        }
+        emit(head, 4 + SALT_SIZE + ivSize);
+    }
+    auto encode = [&](unsigned char* data, size_t len, bool last) {
+        if (gcm) {
+            if (len) {
+                genc.ProcessData(data, data, len);
+                emit(data, len);
+            }
+            if (last) {
+                unsigned char tag[TAG_SIZE];
+                genc.TruncatedFinal(tag, TAG_SIZE);
+                emit(tag, TAG_SIZE);
+            }
+            return;
+        }
+        if (!filter) {
+            emit(data, len);
+            return;
+        }
+        filter->Put(data, len);
+        if (last) filter->MessageEnd();
+        if (!cipher.empty()) {
+            emit((unsigned char*) cipher.data(), cipher.size());
+            cipher.clear();
+        }
+    };
+
+    ZSTD_CCtx* cctx = nullptr;
+    std::vector<unsigned char> out;
+    if (prop & Conf::COMPRESSED) {
+        cctx = threadCCtx(entryLevel);
+        ZSTD_CCtx_setPledgedSrcSize(cctx, size);
+        out.resize(ZSTD_CStreamOutSize());
+    }
+
+    std::vector<unsigned char> window(std::min(bufferSize, size));
+    size_t remaining = size;
+    bool ok = true;
+    while (ok && remaining) {
+        size_t len = std::min(window.size(), remaining);
+        if (!file.read((char*) window.data(), len)) {
+            ok = false;
+            break;
+        }
+        remaining -= len;
+        if (!cctx) {
+            encode(window.data(), len, false);
+            continue;
+        }
+        ZSTD_inBuffer ib = {window.data(), len, 0};
+        ZSTD_EndDirective mode = remaining ? ZSTD_e_continue : ZSTD_e_end;
+        bool finished;
+        do {
+            ZSTD_outBuffer ob = {out.data(), out.size(), 0};
+            auto start = std::chrono::steady_clock::now();
+            size_t left = ZSTD_compressStream2(cctx, &ob, &ib, mode);
+            stats.nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            if (ZSTD_isError(left)) {
+                throw EArchiveException("Compression failed: " + std::string(ZSTD_getErrorName(left)));
+            }
+            encode(out.data(), ob.pos, false);
+            finished = remaining ? (ib.pos == ib.size) : (left == 0);
+        } while (!finished);
+    }
+    if (!ok) return abandon();
+    encode(nullptr, 0, true);
+    if (compressed) {
+        stats.rawBytes += size;
+        stats.packedBytes += written;
+    }
+    if (!key.empty()) {
+        std::lock_guard<std::mutex> lk(dedupLock);
+        payloads[key] = fileNames.size();
+    }
+
+    fileNames.push_back((path.has_filename() ? path : path.parent_path()).filename().u8string());
+    fileOffsets.push_back(prevSize);
+    fileProps.push_back(prop);
+    fileSizes.push_back(written);
+    rawSizes.push_back(size);
+    prevSize += header.size() + written;
+    return true;
+}
+
+void EArchive::AddPath(std::filesystem::path path, unsigned int fsid) {
+    PackedEntry entry;
+    if (!packPath(path, fsid, entry)) {
+        good = false;
+        return;
+    }
+    if (entry.streamed) {
+        if (!streamPath(path)) good = false;
+        return;
+    }
+    writeEntry(path, entry);
 }
 
 void EArchive::MaskProp(unsigned char prop) {
@@ -223,27 +775,203 @@ void EArchive::AddProp(std::filesystem::path path, unsigned char prop) {
 
 bool EArchive::isGood() { return good; }
 
+// Indexes every path DArchive::DumpFSID can resolve without following a
+// symlink: the first root of each name and everything below it.
+std::vector<unsigned char> EArchive::buildPathIndex() const {
+    std::vector<std::pair<std::string, unsigned int>> paths;
+    std::function<void(unsigned int, const std::string&)> walk = [&](unsigned int fsid, const std::string& name) {
+        paths.push_back({name, fsid});
+        if (fileProps[fsid] & Conf::SYMLINK) return;
+        for (auto sub : subs[fsid]) walk(sub, name + "/" + fileNames[sub]);
+    };
+    std::set<std::string> rootNames;
+    for (unsigned int i = 0; i < fileCount; i++) {
+        if (!(fileProps[i] & Conf::ROOTDIR)) continue;
+        if (rootNames.insert(fileNames[i]).second) walk(i, fileNames[i]);
+    }
+    return PathIndex::build(paths);
+}
+// Members of a solid block are written header only, except the last one,
+// which carries the whole compressed block as its payload. The header of
+// that member stays pending until the block is closed.
+void EArchive::addToBlock(PackedEntry& entry) {
+    if (!blockHeader.empty() && block.size() + entry.size > solidSize) closeBlock();
+    if (!blockHeader.empty()) {
+        os.write(blockHeader.data(), blockHeader.size());
+        fileOffsets.push_back(prevSize);
+        fileSizes.push_back(0);
+        prevSize += blockHeader.size();
+    }
+    else blockFirst = solidRefs.size();
+
+    solidRefs.push_back({fileNames.size() - 1, 0, block.size(), entry.size});
+    block.insert(block.end(), entry.content, entry.content + entry.size);
+    blockHeader = entry.header;
+    fileProps.push_back(entry.prop);
+    rawSizes.push_back(entry.rawSize);
+
+    delete[] entry.content;
+    entry.content = nullptr;
+}
+void EArchive::closeBlock() {
+    if (blockHeader.empty()) return;
+    auto[size, content] = compress_data(block.data(), block.size(), level);
+    stats.rawBytes += block.size();
+    stats.packedBytes += size;
+
+    Mask mask;
+    BitInput ib((const unsigned char*) blockHeader.data(), blockHeader.size());
+    ib.read(7);
+    mask.read(ib);
+    mask.versionId(2);
+    mask.mask(content, size, MASK_ROUNDS);
+
+    os.write(blockHeader.data(), blockHeader.size());
+    os.write((const char*) content, size);
+    delete[] content;
+
+    unsigned int carrier = fileOffsets.size();
+    for (size_t i = blockFirst; i < solidRefs.size(); i++) std::get<1>(solidRefs[i]) = carrier;
+    fileOffsets.push_back(prevSize);
+    fileSizes.push_back(size);
+    prevSize += blockHeader.size() + size;
+
+    block.clear();
+    blockHeader.clear();
+}
 void EArchive::FSTable() {
-    std::cout << "Added " << fileCount << " files\n";
+    closeBlock();
+    std::cout << "Added " << fileCount - oldCount << " files\n";
+    if (stats.rawBytes) {
+        std::cout << "Compressed " << stats.rawBytes << " bytes to " << stats.packedBytes
+            << " (saved " << (long long) (stats.rawBytes - stats.packedBytes) << ") in "
+            << stats.nanos / 1e9 << "s\n";
+    }
+    if (adaptive) {
+        std::cout << "Adaptive: " << stats.stored << " stored, " << stats.fast << " fast, " << stats.high << " high\n";
+    }
     std::cout << "Creating the FS Table" << std::endl;
+    std::unordered_map<std::string, unsigned int> nameIds;
+    std::vector<const std::string*> pool;
+    std::vector<unsigned int> nameOf(fileCount);
+    for (unsigned int i = 0; i < fileCount; i++) {
+        auto [it, fresh] = nameIds.insert({fileNames[i], pool.size()});
+        if (fresh) pool.push_back(&it->first);
+        nameOf[i] = it->second;
+    }
+
+    std::vector<unsigned char> table;
+    Varint::put(table, fileCount);
+    Varint::put(table, pool.size());
+    for (auto name : pool) {
+        Varint::put(table, name->size());
+        table.insert(table.end(), name->begin(), name->end());
+    }
+    size_t prevOffset = 0;
     for (unsigned int i = 0; i < fileCount; i++) {
-        unsigned short fnsize = fileNames[i].length();
-        for (size_t j = 0; j < 2; j++) {
-            unsigned char ch = (fnsize >> (j << 3)) & 0xff;
-            os.write((char*) &ch, 1);
+        Varint::put(table, nameOf[i]);
+        Varint::put(table, fileOffsets[i] - prevOffset);
+        prevOffset = fileOffsets[i];
+    }
+    std::vector<unsigned char> tableHead;
+    LE::put(tableHead, table.size(), 8);
+    os.write((const char*) tableHead.data(), tableHead.size());
+    os.write((const char*) table.data(), table.size());
+
+    std::vector<std::pair<unsigned int, std::vector<unsigned char>>> sections;
+    {
+        // Only entries still reachable from a root get a parent. Those an
+        // update superseded stay detached and never show up in listings.
+        std::vector<unsigned int> parents(fileCount, 0xffffffff), pending;
+        for (unsigned int i = 0; i < fileCount; i++) {
+            if (fileProps[i] & Conf::ROOTDIR) pending.push_back(i);
+        }
+        while (!pending.empty()) {
+            unsigned int dir = pending.back();
+            pending.pop_back();
+            for (auto sub : subs[dir]) {
+                if (parents[sub] != 0xffffffff) continue;
+                parents[sub] = dir;
+                pending.push_back(sub);
+            }
         }
-        os.write(fileNames[i].data(), fnsize);
-        unsigned long long foffset = fileOffsets[i];
-        for (size_t j = 0; j < 8; j++) {
-            unsigned char ch = (foffset >> (j << 3)) & 0xff;
-            os.write((char*) &ch, 1);
+        std::vector<unsigned char> data;
+        for (unsigned int i = 0; i < fileCount; i++) {
+            data.push_back(fileProps[i]);
+            LE::put(data, fileSizes[i], 8);
+            LE::put(data, rawSizes[i], 8);
+            LE::put(data, parents[i], 4);
         }
+        sections.push_back({Section::NODES, data});
     }
-    unsigned short endTag = 0x8000;
-    for (size_t i = 0; i < 2; i++) {
-        unsigned char ch = (endTag >> (i << 3)) & 0xff;
-        os.write((char*) &ch, 1);
+    {
+        std::vector<unsigned char> data;
+        for (auto& [size, mtime] : fileStats) {
+            LE::put(data, size, 8);
+            LE::put(data, mtime, 8);
+        }
+        sections.push_back({Section::STAT, data});
+    }
+    if (!dict.empty()) {
+        sections.push_back({Section::DICT, dict});
+    }
+    if (!dedupRefs.empty()) {
+        std::vector<unsigned char> data;
+        for (auto& [fsid, source] : dedupRefs) {
+            LE::put(data, fsid, 4);
+            LE::put(data, source, 4);
+        }
+        sections.push_back({Section::DEDUP, data});
+    }
+    if (!frameRefs.empty()) {
+        std::vector<unsigned char> data;
+        for (auto& [fsid, size, ends] : frameRefs) {
+            LE::put(data, fsid, 4);
+            LE::put(data, size, 4);
+            LE::put(data, ends.size(), 4);
+            for (auto end : ends) LE::put(data, end, 8);
+        }
+        sections.push_back({Section::FRAMES, data});
     }
+    if (!solidRefs.empty()) {
+        std::vector<unsigned char> data;
+        for (auto& [fsid, carrier, offset, size] : solidRefs) {
+            LE::put(data, fsid, 4);
+            LE::put(data, carrier, 4);
+            LE::put(data, offset, 4);
+            LE::put(data, size, 4);
+        }
+        sections.push_back({Section::SOLID, data});
+    }
+    if (!keySalts.empty()) {
+        std::vector<unsigned char> data;
+        LE::put(data, keySalts.size(), 4);
+        for (auto& [kix, salt] : keySalts) {
+            LE::put(data, kix, 4);
+            data.push_back(keyScheme);
+            data.insert(data.end(), salt.begin(), salt.end());
+        }
+        sections.push_back({Section::KEYS, data});
+    }
+    if (pathIndex && fileCount) {
+        sections.push_back({Section::PATHS, buildPathIndex()});
+    }
+    for (auto& [id, data] : sections) {
+        std::vector<unsigned char> head;
+        LE::put(head, id, 4);
+        LE::put(head, data.size(), 8);
+        os.write((const char*) head.data(), head.size());
+        os.write((const char*) data.data(), data.size());
+    }
+    std::vector<unsigned char> tail;
+    LE::put(tail, Section::END, 4);
+    os.write((const char*) tail.data(), tail.size());
+    archiveEnd = os.tellp();
+
+    std::vector<unsigned char> version;
+    LE::put(version, !frameRefs.empty() ? 7 : !dedupRefs.empty() ? 6 : !solidRefs.empty() ? 5 : 4, 2);
+    os.seekp(6, std::ios::beg);
+    os.write((const char*) version.data(), version.size());
 
     os.seekp(8, std::ios::beg);
     unsigned long long fstOffset = prevSize;
@@ -254,7 +982,155 @@ void EArchive::FSTable() {
     }
 }
 
+void EArchive::runParallel() {
+    std::vector<std::filesystem::path> paths;
+    while (!routines.empty()) {
+        paths.push_back(routines.front());
+        routines.pop();
+    }
+
+    // Workers pack entries out of order; this thread writes them back in
+    // routine order, so the layout matches a serial run. At most `window`
+    // packed entries are held in memory at once.
+    size_t count = paths.size(), window = threads * 4;
+    std::vector<PackedEntry> slots(count);
+    std::vector<unsigned char> ready(count, 0);
+    std::exception_ptr error;
+    std::mutex lock;
+    std::condition_variable packed, drained;
+    size_t next = 0, written = 0;
+    bool stop = false;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lk(lock);
+                drained.wait(lk, [&]() { return stop || next >= count || next < written + window; });
+                if (stop || next >= count) return;
+                i = next++;
+            }
+            PackedEntry entry;
+            std::exception_ptr err;
+            try {
+                packPath(paths[i], pth2fsid.at(paths[i].lexically_normal().generic_u8string()), entry);
+            }
+            catch (...) {
+                entry.content = nullptr;
+                entry.ok = false;
+                err = std::current_exception();
+            }
+            {
+                std::lock_guard<std::mutex> lk(lock);
+                slots[i] = entry;
+                ready[i] = 1;
+                if (err && !error) error = err;
+            }
+            packed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < threads; i++) pool.emplace_back(worker);
+
+    for (size_t i = 0; i < count; i++) {
+        PackedEntry entry;
+        {
+            std::unique_lock<std::mutex> lk(lock);
+            packed.wait(lk, [&]() { return ready[i] != 0; });
+            entry = slots[i];
+            slots[i].content = nullptr;
+        }
+        if (!entry.ok) {
+            good = false;
+            break;
+        }
+        if (entry.streamed) {
+            if (!streamPath(paths[i])) {
+                good = false;
+                break;
+            }
+        }
+        else writeEntry(paths[i], entry);
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            written++;
+        }
+        drained.notify_all();
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(lock);
+        stop = true;
+    }
+    drained.notify_all();
+    for (auto& t : pool) t.join();
+    for (size_t i = 0; i < count; i++) {
+        if (ready[i]) delete[] slots[i].content;
+    }
+
+    if (error) std::rethrow_exception(error);
+}
+
+// Trains on the head of every file that will be compressed, in routine
+// order, until the sample budget is spent.
+void EArchive::trainDictionary() {
+    std::vector<unsigned char> samples;
+    std::vector<size_t> sampleSizes;
+    size_t budget = dictSize * DICT_SAMPLE_RATIO;
+    auto pending = routines;
+    while (!pending.empty() && samples.size() < budget) {
+        auto path = pending.front();
+        pending.pop();
+        unsigned char prop = propOf(path);
+        if (!(prop & Conf::COMPRESSED) || (prop & (Conf::PATH | Conf::SYMLINK))) continue;
+        std::error_code ec;
+        size_t size = std::min(std::filesystem::file_size(toPlatformPath(path), ec), DICT_SAMPLE_LIMIT);
+        if (ec || !size) continue;
+        std::ifstream file(toPlatformPath(path), std::ios::binary);
+        samples.resize(samples.size() + size);
+        if (!file.read((char*) samples.data() + samples.size() - size, size)) {
+            samples.resize(samples.size() - size);
+            continue;
+        }
+        sampleSizes.push_back(size);
+    }
+
+    dict.resize(dictSize);
+    size_t trained = ZDICT_trainFromBuffer(dict.data(), dict.size(), samples.data(), sampleSizes.data(), sampleSizes.size());
+    if (ZDICT_isError(trained)) {
+        std::cout << "Dictionary skipped: " << ZDICT_getErrorName(trained) << std::endl;
+        dict.clear();
+        return;
+    }
+    dict.resize(trained);
+    cdict = ZSTD_createCDict(dict.data(), dict.size(), level);
+    std::cout << "Trained a " << trained << " byte dictionary on " << sampleSizes.size() << " files" << std::endl;
+}
 void EArchive::RunRoutines() {
+    // Compared only now, once every prop option has been given.
+    for (auto& path : updates) updateRoot(path);
+    if (updating) {
+        // The old archive is read until here and only then opened for
+        // writing, as its mapping may not share the file with a writer.
+        previous.reset();
+        os.open(toPlatformPath(archivePath), std::ios::in | std::ios::out | std::ios::binary);
+        if (!os) {
+            good = false;
+            return;
+        }
+        os.seekp(prevSize, std::ios::beg);
+    }
+    if (dictSize && updating && dict.empty()) {
+        std::cout << "Dictionary skipped: the archive has none to extend" << std::endl;
+    }
+    else if (dictSize && !updating) trainDictionary();
+    if (!dict.empty() && !cdict) cdict = ZSTD_createCDict(dict.data(), dict.size(), level);
+    if (!dict.empty() && adaptive && !fastCDict) fastCDict = ZSTD_createCDict(dict.data(), dict.size(), ADAPTIVE_FAST_LEVEL);
+    if (threads > 1) {
+        runParallel();
+        return;
+    }
     while (!routines.empty()) {
         auto pth = routines.front();
         routines.pop();
@@ -289,11 +1165,60 @@ void EArchive::SetExecPri(std::filesystem::path path, unsigned int pri) {
     execpri.insert({pth, pri});
 }
 
+void EArchive::SetThreads(unsigned int count) {
+    if (count == 0) count = std::thread::hardware_concurrency();
+    threads = count ? count : 1;
+}
+
+// Entries already in an updated archive were keyed under its scheme, and
+// the reader keeps one scheme per key index.
+void EArchive::SetKeyScheme(unsigned char scheme) {
+    if (updating && (oldEncrypted || !keySalts.empty()) && (scheme & ~keyScheme)) {
+        throw EArchiveException("The key scheme of an archive can't change on update.");
+    }
+    keyScheme |= scheme;
+}
+void EArchive::SetPathIndex(bool enable) {
+    pathIndex = enable;
+}
+void EArchive::SetFrameSize(size_t size) {
+    frameSize = std::min<size_t>(size, 0xffffffff);
+}
+void EArchive::SetSolidSize(size_t size) {
+    solidSize = std::min<size_t>(size, 0xffffffff);
+}
+void EArchive::SetDictSize(size_t size) {
+    dictSize = size;
+}
+void EArchive::SetLevel(int level) {
+    this->level = level;
+}
+void EArchive::SetLongMatching(bool enable) {
+    longMatching = enable;
+}
+void EArchive::SetWindowLog(int log) {
+    windowLog = log;
+}
+void EArchive::SetZstdWorkers(int count) {
+    zstdWorkers = count;
+}
+void EArchive::SetAdaptive(bool enable) {
+    adaptive = enable;
+}
+void EArchive::SetDedup(bool enable) {
+    dedup = enable;
+}
+
+void EArchive::SetBufferSize(size_t size) {
+    bufferSize = size ? size : 1;
+}
+
 void EArchive::AddRoutine(std::filesystem::path path, bool isRoot) {
     routines.push(path);
     if (isRoot) AddProp(path, Conf::ROOTDIR);
     unsigned int selfId = fileCount++;
     subs.push_back({});
+    fileStats.push_back(statOf(path));
 
     if (pth2fsid.find(path.lexically_normal().generic_u8string()) != pth2fsid.end()) {
         good = false;
@@ -322,9 +1247,170 @@ void EArchive::AddRoutine(std::filesystem::path path, bool isRoot) {
     }
 }
 
-EArchive::EArchive(std::string out) {
+// Updating starts from the tree of the existing archive. New and changed
+// entries go after its end, and the header moves to the new FS table only
+// once that is written, so a failed update leaves the old archive intact.
+// Files are only matched against the old entries by path: dedup doesn't
+// see the old payloads, whose digests would take decoding them all.
+void EArchive::loadArchive() {
+    previous.reset(new DArchive(archivePath));
+    DArchive& old = *previous;
+    old.FSTable();
+    if (old.sections.find(Section::NODES) == old.sections.end()) {
+        throw EArchiveException("Only archives with a node table can be updated.");
+    }
+    old.TestRootdir();
+
+    fileCount = oldCount = old.fileCount;
+    for (unsigned int i = 0; i < fileCount; i++) {
+        const auto& node = old.nodes[i];
+        fileNames.emplace_back(old.fileNames[i]);
+        fileOffsets.push_back(old.fileOffsets[i]);
+        fileProps.push_back(node.prop);
+        fileSizes.push_back(old.fileSizes[i]);
+        rawSizes.push_back(node.rawSize);
+        subs.push_back((node.prop & Conf::SYMLINK) ? std::vector<unsigned int>() : node.children);
+        if (node.prop & Conf::ENCRYPTED) oldEncrypted = true;
+    }
+    oldRoots = old.rootdir;
+
+    std::vector<unsigned char> data;
+    fileStats.assign(fileCount, {(unsigned long long) -1, 0});
+    if (old.readSection(Section::STAT, data) && data.size() == (size_t) fileCount * 16) {
+        for (unsigned int i = 0; i < fileCount; i++) {
+            fileStats[i] = {LE::get(data.data() + i * 16, 8), LE::get(data.data() + i * 16 + 8, 8)};
+        }
+    }
+    for (unsigned int i = 0; i < old.solidRefs.size(); i++) {
+        auto& ref = old.solidRefs[i];
+        if (ref.block != 0xffffffff) solidRefs.push_back({i, ref.block, ref.offset, ref.size});
+    }
+    for (unsigned int i = 0; i < old.frameRefs.size(); i++) {
+        auto& ref = old.frameRefs[i];
+        if (!ref.ends.empty()) frameRefs.push_back({i, ref.frameSize, ref.ends});
+    }
+    for (unsigned int i = 0; i < old.dedupSources.size(); i++) {
+        if (old.dedupSources[i] != 0xffffffff) dedupRefs.push_back({i, old.dedupSources[i]});
+    }
+    for (auto& [kix, scheme] : old.keySchemes) {
+        keyScheme |= scheme.first;
+        keySalts[kix] = scheme.second;
+    }
+    old.readSection(Section::DICT, dict);
+    prevSize = std::filesystem::file_size(toPlatformPath(archivePath));
+    // Until a new table is written, anything appended is cut off again.
+    archiveEnd = prevSize;
+}
+std::pair<unsigned long long, unsigned long long> EArchive::statOf(const std::filesystem::path& path) const {
+    std::error_code ec;
+    auto size = std::filesystem::file_size(toPlatformPath(path), ec);
+    if (ec) return {(unsigned long long) -1, 0};
+    auto mtime = std::filesystem::last_write_time(toPlatformPath(path), ec);
+    if (ec) return {(unsigned long long) -1, 0};
+    return {size, mtime.time_since_epoch().count()};
+}
+// Returns the fsid `path` ends up with: `old` when neither the file nor
+// anything below it changed, otherwise a new entry. Directories are
+// visited after their children so a changed child also replaces them.
+unsigned int EArchive::updatePath(const std::filesystem::path& path, unsigned int old, bool isRoot) {
+    std::error_code ec;
+    bool isDir = std::filesystem::is_directory(toPlatformPath(path), ec);
+    if (ec) {
+        good = false;
+        throw EArchiveException("Cannot test if " + toPlatformPath(path).u8string() + " is a directory");
+    }
+    if (isRoot) AddProp(path, Conf::ROOTDIR);
+    if (isDir) AddProp(path, Conf::PATH);
+    unsigned char prop = propOf(path);
+    bool reusable = old != 0xffffffff && !((prop | fileProps[old]) & Conf::SYMLINK)
+        && !((prop ^ fileProps[old]) & ~Conf::COMPRESSED);
+    // Read last, as it means reading the old payload's head.
+    auto sameKey = [&]() {
+        return !(prop & Conf::ENCRYPTED) || previous->keyIndexOf(old) == kixOf(path);
+    };
+
+    if (!isDir || (prop & Conf::SYMLINK)) {
+        if (!reusable || fileStats[old] != statOf(path) || !sameKey()) {
+            unsigned int fsid = fileCount;
+            AddRoutine(path, isRoot);
+            return fsid;
+        }
+    }
+    else {
+        std::map<std::string, unsigned int> oldSubs;
+        if (reusable) {
+            for (auto sub : subs[old]) oldSubs.insert({fileNames[sub], sub});
+        }
+        auto dit = std::filesystem::directory_iterator(toPlatformPath(path), ec);
+        if (ec) {
+            good = false;
+            throw EArchiveException("Cannot open directory: " + path.lexically_normal().generic_u8string());
+        }
+        std::vector<unsigned int> children;
+        for (const auto& entry : dit) {
+            auto it = oldSubs.find(entry.path().filename().u8string());
+            children.push_back(updatePath(entry.path(), it == oldSubs.end() ? 0xffffffff : it->second, false));
+        }
+        // Kept in fsid order, the order the reader lists children in.
+        std::sort(children.begin(), children.end());
+        if (!reusable || children != subs[old] || !sameKey()) {
+            old = fileCount++;
+            routines.push(path);
+            subs.push_back(children);
+            fileStats.push_back(statOf(path));
+        }
+    }
+
+    if (!pth2fsid.insert({path.lexically_normal().generic_u8string(), old}).second) {
+        good = false;
+        throw EArchiveException("Duplicate path: " + path.lexically_normal().generic_u8string());
+    }
+    return old;
+}
+void EArchive::UpdateRoutine(std::filesystem::path path) {
+    updates.push_back(path);
+}
+void EArchive::updateRoot(const std::filesystem::path& path) {
+    std::string name = (path.has_filename() ? path : path.parent_path()).filename().u8string();
+    unsigned int old = 0xffffffff;
+    for (auto fsid : oldRoots) {
+        if (fileNames[fsid] == name) {
+            old = fsid;
+            break;
+        }
+    }
+    unsigned int fsid = updatePath(path, old, true);
+    if (old != 0xffffffff && fsid != old) fileProps[old] &= ~Conf::ROOTDIR;
+}
+EArchive::EArchive(std::string out, bool update) {
     good = true;
     maskProp = 0;
+    threads = 1;
+    bufferSize = STREAM_BUFFER_SIZE;
+    keyScheme = 0;
+    pathIndex = false;
+    solidSize = 0;
+    blockFirst = 0;
+    dictSize = 0;
+    cdict = nullptr;
+    fastCDict = nullptr;
+    level = 11;
+    windowLog = 0;
+    zstdWorkers = 0;
+    longMatching = false;
+    adaptive = false;
+    dedup = false;
+    frameSize = 0;
+    updating = update;
+    archivePath = out;
+    archiveEnd = 0;
+    oldCount = 0;
+    oldEncrypted = false;
+
+    if (updating) {
+        loadArchive();
+        return;
+    }
 
     os.open(toPlatformPath(out), std::ios::binary);
     if (!os) {
@@ -346,5 +1432,13 @@ EArchive::EArchive(std::string out) {
 }
 
 EArchive::~EArchive() {
+    if (cdict) ZSTD_freeCDict(cdict);
+    if (fastCDict) ZSTD_freeCDict(fastCDict);
     if (os) os.close();
+    if (archiveEnd) {
+        // Entries the writer rewound over may have left bytes past the
+        // table.
+        std::error_code ec;
+        std::filesystem::resize_file(toPlatformPath(archivePath), archiveEnd, ec);
+    }
 }
\ No newline at end of file
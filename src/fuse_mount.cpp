@@ -0,0 +1,113 @@
+#define FUSE_USE_VERSION 31
+
+#include "fuse_mount.hpp"
+#include "darchive.hpp"
+#include <fuse.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <set>
+
+// Paths are looked up through the FS table on every call and contents are
+// decoded on first read; symlinks show up as the entries they point to.
+// libfuse calls in from several threads; DArchive guards its node table
+// and caches itself, so reads of different files run side by side.
+static DArchive* mountArchive() {
+    return (DArchive*) fuse_get_context()->private_data;
+}
+
+// The mount point itself is 0xffffffff, the parent of the root entries.
+static bool lookup(DArchive* arch, const char* path, unsigned int& fsid) {
+    if (!std::strcmp(path, "/")) {
+        fsid = 0xffffffff;
+        return true;
+    }
+    fsid = arch->DumpFSID(path + 1);
+    if (fsid == 0xffffffff) return false;
+    fsid = arch->resolveLink(fsid);
+    return fsid != 0xffffffff;
+}
+
+static int mountGetattr(const char* path, struct stat* st, struct fuse_file_info*) {
+    DArchive* arch = mountArchive();
+    std::memset(st, 0, sizeof(*st));
+    try {
+        unsigned int fsid;
+        if (!lookup(arch, path, fsid)) return -ENOENT;
+        if (fsid == 0xffffffff || arch->isDirectory(fsid)) {
+            st->st_mode = S_IFDIR | 0555;
+            st->st_nlink = 2;
+        }
+        else {
+            st->st_mode = S_IFREG | 0444;
+            st->st_nlink = 1;
+            st->st_size = arch->getSize(fsid);
+        }
+    }
+    catch (const std::exception&) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static int mountReaddir(const char* path, void* buf, fuse_fill_dir_t filler, off_t, struct fuse_file_info*, enum fuse_readdir_flags) {
+    DArchive* arch = mountArchive();
+    try {
+        unsigned int fsid;
+        if (!lookup(arch, path, fsid)) return -ENOENT;
+        if (fsid != 0xffffffff && !arch->isDirectory(fsid)) return -ENOTDIR;
+        filler(buf, ".", nullptr, 0, (enum fuse_fill_dir_flags) 0);
+        filler(buf, "..", nullptr, 0, (enum fuse_fill_dir_flags) 0);
+        // Lookups find the first entry of a name, so only that one is listed.
+        std::set<std::string> names;
+        for (auto child : arch->listDirectory(fsid == 0xffffffff ? -1 : (int) fsid)) {
+            std::string name = arch->getName(child);
+            if (names.insert(name).second) filler(buf, name.c_str(), nullptr, 0, (enum fuse_fill_dir_flags) 0);
+        }
+    }
+    catch (const std::exception&) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static int mountOpen(const char* path, struct fuse_file_info* fi) {
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) return -EROFS;
+    DArchive* arch = mountArchive();
+    try {
+        unsigned int fsid;
+        if (!lookup(arch, path, fsid)) return -ENOENT;
+        if (fsid == 0xffffffff || arch->isDirectory(fsid)) return -EISDIR;
+        fi->fh = fsid;
+    }
+    catch (const std::exception&) {
+        return -EIO;
+    }
+    return 0;
+}
+
+static int mountRead(const char*, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    DArchive* arch = mountArchive();
+    try {
+        return arch->ReadRange((unsigned int) fi->fh, offset, buf, size);
+    }
+    catch (const std::exception&) {
+        return -EIO;
+    }
+}
+
+int MountArchive(DArchive& arch, const std::string& mountpoint, const std::vector<std::string>& options) {
+    struct fuse_operations ops;
+    std::memset(&ops, 0, sizeof(ops));
+    ops.getattr = mountGetattr;
+    ops.readdir = mountReaddir;
+    ops.open = mountOpen;
+    ops.read = mountRead;
+
+    std::vector<std::string> args = {"mkar", mountpoint, "-f", "-o", "ro,fsname=mkar"};
+    args.insert(args.end(), options.begin(), options.end());
+    std::vector<char*> argv;
+    for (auto& arg : args) argv.push_back(arg.data());
+
+    return fuse_main(argv.size(), argv.data(), &ops, &arch);
+}
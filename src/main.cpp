@@ -10,6 +10,9 @@
 #include "platform.hpp"
 #include <cstring>
 #include "conf.hpp"
+#ifdef MKAR_FUSE
+# include "fuse_mount.hpp"
+#endif
 
 int main(int argc, char* argv[]) {
     #ifdef _WIN32
@@ -31,8 +34,9 @@ int main(int argc, char* argv[]) {
     bool hasEachE = false, hasAllE = false, hasEachC = false, hasAllC = false;
     
     try {
-        if (method == "e") {
-            EArchive earch(archive);
+        if (method == "e" || method == "u") {
+            bool update = method == "u";
+            EArchive earch(archive, update);
             for (int i = 3; i < argc; i++) {
                 std::string str = argv[i];
                 if (str == "-e") {
@@ -125,6 +129,88 @@ int main(int argc, char* argv[]) {
                     earch.MaskProp(Conf::COMPRESSED);
                     hasAllC = true;
                 }
+                else if (str == "-j") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    earch.SetThreads(std::strtoul(argv[i + 1], nullptr, 0));
+                    i++;
+                }
+                else if (str == "-b") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    earch.SetBufferSize(std::strtoull(argv[i + 1], nullptr, 0));
+                    i++;
+                }
+                else if (str == "-K") {
+                    earch.SetKeyScheme(KeyScheme::DERIVED);
+                }
+                else if (str == "-G") {
+                    earch.SetKeyScheme(KeyScheme::GCM);
+                }
+                else if (str == "-i") {
+                    earch.SetPathIndex(true);
+                }
+                else if (str == "-D") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    earch.SetDictSize(std::strtoull(argv[i + 1], nullptr, 0));
+                    i++;
+                }
+                else if (str == "-L") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    earch.SetLevel(std::strtol(argv[i + 1], nullptr, 0));
+                    i++;
+                }
+                else if (str == "-W") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    earch.SetWindowLog(std::strtol(argv[i + 1], nullptr, 0));
+                    i++;
+                }
+                else if (str == "-T") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    earch.SetZstdWorkers(std::strtol(argv[i + 1], nullptr, 0));
+                    i++;
+                }
+                else if (str == "-U") {
+                    earch.SetDedup(true);
+                }
+                else if (str == "-A") {
+                    earch.SetAdaptive(true);
+                }
+                else if (str == "-M") {
+                    earch.SetLongMatching(true);
+                }
+                else if (str == "-F") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    earch.SetFrameSize(std::strtoull(argv[i + 1], nullptr, 0));
+                    i++;
+                }
+                else if (str == "-S") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    earch.SetSolidSize(std::strtoull(argv[i + 1], nullptr, 0));
+                    i++;
+                }
                 else if (str == "-p") {
                     if (argc - i < 3) {
                         std::cerr << "Wrong format!\n";
@@ -140,31 +226,36 @@ int main(int argc, char* argv[]) {
                     }
                     i += 2;
                 }
+                else if (update) {
+                    earch.UpdateRoutine(str);
+                }
                 else {
                     earch.AddRoutine(str);
                 }
             }
             std::cerr << "[routine done]\n";
             earch.RunRoutines();
+            if (!earch.isGood()) {
+                std::cerr << "Some entries could not be packed!\n";
+                return 1;
+            }
             earch.FSTable();
         }
         else if (method == "d") {
             DArchive darch(archive);
-            onMissingPassword = [](unsigned int kix)->bool {
+            darch.SetPasswordCallbacks([&darch](unsigned int kix)->bool {
                 std::cout << "Please enter the key for index " << kix << ":\n";
                 std::string key;
-                std::cin >> key;
-                g_arch->SetKey(kix, key);
+                if (!(std::cin >> key)) return false;
+                darch.SetKey(kix, key);
                 return true;
-            };
-            onIncorrectPassword = [](unsigned int kix)->bool {
+            }, [&darch](unsigned int kix)->bool {
                 std::cout << "The key for index " << kix << " is incorrect, please try again:\n";
                 std::string key;
-                std::cin >> key;
-                g_arch->SetKey(kix, key);
+                if (!(std::cin >> key)) return false;
+                darch.SetKey(kix, key);
                 return true;
-            };
-            g_arch = &darch;
+            });
             darch.FSTable();
             darch.TestRootdir();
             bool hasMention = false;
@@ -187,6 +278,30 @@ int main(int argc, char* argv[]) {
                 else if (std::string(argv[i]) == "-s") {
                     darch.Safe();
                 }
+                else if (std::string(argv[i]) == "-j") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    darch.SetThreads(std::strtoul(argv[i + 1], nullptr, 0));
+                    i++;
+                }
+                else if (std::string(argv[i]) == "-b") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    darch.SetBufferSize(std::strtoull(argv[i + 1], nullptr, 0));
+                    i++;
+                }
+                else if (std::string(argv[i]) == "-c") {
+                    if (argc - i < 2) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    darch.SetConnections(std::strtoul(argv[i + 1], nullptr, 0));
+                    i++;
+                }
                 else {
                     hasMention = true;
                     if (argc - i < 2) {
@@ -208,6 +323,46 @@ int main(int argc, char* argv[]) {
             else darch.ExtractAll();
             darch.PostExtract();
         }
+        else if (method == "m") {
+            #ifdef MKAR_FUSE
+            if (argc < 4) {
+                std::cerr << "Wrong format!\n";
+                return 1;
+            }
+            DArchive darch(archive);
+            // Nobody can answer a prompt once mounted.
+            auto noKey = [](unsigned int kix)->bool {
+                std::cerr << "No usable key for index " << kix << "\n";
+                return false;
+            };
+            darch.SetPasswordCallbacks(noKey, noKey);
+            darch.FSTable();
+            darch.TestRootdir();
+            std::vector<std::string> options;
+            for (int i = 4; i < argc; i++) {
+                if (std::string(argv[i]) == "-p") {
+                    if (argc - i < 3) {
+                        std::cerr << "Wrong format!\n";
+                        return 1;
+                    }
+                    try {
+                        unsigned int kix = std::strtoul(argv[i + 1], nullptr, 0);
+                        darch.SetKey(kix, argv[i + 2]);
+                    }
+                    catch (const std::exception& e) {
+                        std::cerr << "Error while parsing KEY: " << e.what() << '\n';
+                        return 1;
+                    }
+                    i += 2;
+                }
+                else options.push_back(argv[i]);
+            }
+            if (MountArchive(darch, argv[3], options)) return 1;
+            #else
+            std::cerr << "This build has no FUSE support!\n";
+            return 1;
+            #endif
+        }
         else {
             std::cerr << "Unknown operation type!\n";
             return 1;
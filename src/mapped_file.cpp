@@ -0,0 +1,88 @@
+#include "mapped_file.hpp"
+#include <cstdint>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+bool MappedFile::open(const std::filesystem::path& path) {
+    close();
+#ifdef _WIN32
+    HANDLE f = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fsize;
+    if (!GetFileSizeEx(f, &fsize) || fsize.QuadPart == 0 || (unsigned long long) fsize.QuadPart > SIZE_MAX) {
+        CloseHandle(f);
+        return false;
+    }
+    HANDLE m = CreateFileMappingW(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!m) {
+        CloseHandle(f);
+        return false;
+    }
+    void* view = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(m);
+        CloseHandle(f);
+        return false;
+    }
+    file = f;
+    mapping = m;
+    ptr = (const unsigned char*) view;
+    len = (size_t) fsize.QuadPart;
+#else
+    int f = ::open(path.c_str(), O_RDONLY);
+    if (f < 0) return false;
+    struct stat st;
+    if (fstat(f, &st) != 0 || st.st_size <= 0 || (unsigned long long) st.st_size > SIZE_MAX) {
+        ::close(f);
+        return false;
+    }
+    void* view = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, f, 0);
+    if (view == MAP_FAILED) {
+        ::close(f);
+        return false;
+    }
+    fd = f;
+    ptr = (const unsigned char*) view;
+    len = st.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+    if (!ptr) return;
+#ifdef _WIN32
+    UnmapViewOfFile(ptr);
+    CloseHandle(mapping);
+    CloseHandle(file);
+    file = mapping = nullptr;
+#else
+    munmap((void*) ptr, len);
+    ::close(fd);
+    fd = -1;
+#endif
+    ptr = nullptr;
+    len = 0;
+}
+
+bool MappedFile::isMapped() const { return ptr != nullptr; }
+
+const unsigned char* MappedFile::data() const { return ptr; }
+
+size_t MappedFile::size() const { return len; }
+
+#ifdef _WIN32
+MappedFile::MappedFile() : ptr(nullptr), len(0), file(nullptr), mapping(nullptr) {}
+#else
+MappedFile::MappedFile() : ptr(nullptr), len(0), fd(-1) {}
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
@@ -0,0 +1,290 @@
+#include "mask_simd.hpp"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+# define MKAR_MASK_X86
+# include <immintrin.h>
+# ifdef _MSC_VER
+#  include <intrin.h>
+# endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+# define MKAR_TARGET(x) __attribute__((target(x)))
+#else
+# define MKAR_TARGET(x)
+#endif
+
+// A Fenwick node at 1-based position k covers (k - lowbit(k), k]. Encoding
+// xors into each byte the nodes of every smaller size that end right
+// before it, which is also how decoding undoes it; `levels[t]` keeps the
+// last encoded byte of size 2^t.
+static void fenwickScalar(bool encode, unsigned char* buf, size_t len, unsigned long long pos, unsigned char* levels) {
+    for (size_t i = 0; i < len; i++) {
+        int t = lowest_bit(++pos);
+        unsigned char c = buf[i];
+        for (int l = 0; l < t; l++) buf[i] ^= levels[l];
+        levels[t] = encode ? buf[i] : c;
+    }
+}
+
+static void fenwickEncodeScalar(unsigned char* buf, size_t blocks, unsigned long long pos, unsigned char* levels) {
+    fenwickScalar(true, buf, blocks * MASK_BLOCK, pos, levels);
+}
+
+static void fenwickDecodeScalar(unsigned char* buf, size_t blocks, unsigned long long pos, unsigned char* levels) {
+    fenwickScalar(false, buf, blocks * MASK_BLOCK, pos, levels);
+}
+
+static void xorScanScalar(const unsigned char* in, unsigned char* out, size_t len, unsigned char& carry) {
+    unsigned char c = carry;
+    for (size_t i = 0; i < len; i++) out[i] = (c ^= in[i]);
+    carry = c;
+}
+
+static void addScanScalar(unsigned char* buf, size_t len, unsigned char& carry) {
+    unsigned char c = carry;
+    for (size_t i = 0; i < len; i++) buf[i] = (c += buf[i]);
+    carry = c;
+}
+
+static const MaskKernels scalarKernels = {
+    "scalar", fenwickEncodeScalar, fenwickDecodeScalar, xorScanScalar, addScanScalar
+};
+
+#ifdef MKAR_MASK_X86
+
+// Inside a block the vector code covers nodes of up to 32 bytes; the last
+// byte of the block also takes the nodes of 32 bytes and more that end
+// before it. `enc` holds the encoded bytes of the block.
+static inline void finishBlock(unsigned char* b, const unsigned char* enc, unsigned long long end, unsigned char* levels) {
+    int t = lowest_bit(end);
+    unsigned char f = 0;
+    for (int l = 5; l < t; l++) f ^= levels[l];
+    b[31] ^= f;
+    levels[0] = enc[30];
+    levels[1] = enc[29];
+    levels[2] = enc[27];
+    levels[3] = enc[23];
+    levels[4] = enc[15];
+    levels[t] = enc[31];
+}
+
+// Bytes i with (i + 1) % (2 * m) == 0 within each 16-byte lane.
+#define MKAR_LANE_MASKS(set) \
+    const auto m1 = set(0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1, 0, -1); \
+    const auto m2 = set(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1); \
+    const auto m4 = set(0, 0, 0, 0, 0, 0, 0, -1, 0, 0, 0, 0, 0, 0, 0, -1); \
+    const auto m8 = set(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1);
+
+#define MKAR_SSE_SET(...) _mm_setr_epi8(__VA_ARGS__)
+#define MKAR_AVX_SET(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+MKAR_TARGET("sse2")
+static inline __m128i upSweepSSE2(__m128i v) {
+    MKAR_LANE_MASKS(MKAR_SSE_SET)
+    v = _mm_xor_si128(v, _mm_and_si128(_mm_slli_si128(v, 1), m1));
+    v = _mm_xor_si128(v, _mm_and_si128(_mm_slli_si128(v, 2), m2));
+    v = _mm_xor_si128(v, _mm_and_si128(_mm_slli_si128(v, 4), m4));
+    v = _mm_xor_si128(v, _mm_and_si128(_mm_slli_si128(v, 8), m8));
+    return v;
+}
+
+MKAR_TARGET("sse2")
+static inline __m128i downSweepSSE2(__m128i v) {
+    MKAR_LANE_MASKS(MKAR_SSE_SET)
+    __m128i x = _mm_xor_si128(v, _mm_and_si128(_mm_slli_si128(v, 1), m1));
+    x = _mm_xor_si128(x, _mm_and_si128(_mm_slli_si128(v, 2), m2));
+    x = _mm_xor_si128(x, _mm_and_si128(_mm_slli_si128(v, 4), m4));
+    x = _mm_xor_si128(x, _mm_and_si128(_mm_slli_si128(v, 8), m8));
+    return x;
+}
+
+MKAR_TARGET("sse2")
+static void fenwickEncodeSSE2(unsigned char* buf, size_t blocks, unsigned long long pos, unsigned char* levels) {
+    const __m128i last = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1);
+    for (size_t j = 0; j < blocks; j++, buf += MASK_BLOCK) {
+        __m128i lo = upSweepSSE2(_mm_loadu_si128((const __m128i*) buf));
+        __m128i hi = upSweepSSE2(_mm_loadu_si128((const __m128i*) (buf + 16)));
+        hi = _mm_xor_si128(hi, _mm_and_si128(lo, last));
+        _mm_storeu_si128((__m128i*) buf, lo);
+        _mm_storeu_si128((__m128i*) (buf + 16), hi);
+        pos += MASK_BLOCK;
+        finishBlock(buf, buf, pos, levels);
+    }
+}
+
+MKAR_TARGET("sse2")
+static void fenwickDecodeSSE2(unsigned char* buf, size_t blocks, unsigned long long pos, unsigned char* levels) {
+    const __m128i last = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, -1);
+    unsigned char enc[MASK_BLOCK];
+    for (size_t j = 0; j < blocks; j++, buf += MASK_BLOCK) {
+        __m128i lo = _mm_loadu_si128((const __m128i*) buf);
+        __m128i hi = _mm_loadu_si128((const __m128i*) (buf + 16));
+        _mm_storeu_si128((__m128i*) enc, lo);
+        _mm_storeu_si128((__m128i*) (enc + 16), hi);
+        __m128i xhi = _mm_xor_si128(downSweepSSE2(hi), _mm_and_si128(lo, last));
+        _mm_storeu_si128((__m128i*) buf, downSweepSSE2(lo));
+        _mm_storeu_si128((__m128i*) (buf + 16), xhi);
+        pos += MASK_BLOCK;
+        finishBlock(buf, enc, pos, levels);
+    }
+}
+
+MKAR_TARGET("sse2")
+static void xorScanSSE2(const unsigned char* in, unsigned char* out, size_t len, unsigned char& carry) {
+    unsigned char c = carry;
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (in + i));
+        v = _mm_xor_si128(v, _mm_slli_si128(v, 1));
+        v = _mm_xor_si128(v, _mm_slli_si128(v, 2));
+        v = _mm_xor_si128(v, _mm_slli_si128(v, 4));
+        v = _mm_xor_si128(v, _mm_slli_si128(v, 8));
+        v = _mm_xor_si128(v, _mm_set1_epi8((char) c));
+        _mm_storeu_si128((__m128i*) (out + i), v);
+        c = out[i + 15];
+    }
+    carry = c;
+}
+
+MKAR_TARGET("sse2")
+static void addScanSSE2(unsigned char* buf, size_t len, unsigned char& carry) {
+    unsigned char c = carry;
+    for (size_t i = 0; i < len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (buf + i));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 1));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 2));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi8(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi8(v, _mm_set1_epi8((char) c));
+        _mm_storeu_si128((__m128i*) (buf + i), v);
+        c = buf[i + 15];
+    }
+    carry = c;
+}
+
+static const MaskKernels sse2Kernels = {
+    "sse2", fenwickEncodeSSE2, fenwickDecodeSSE2, xorScanSSE2, addScanSSE2
+};
+
+MKAR_TARGET("avx2")
+static void fenwickEncodeAVX2(unsigned char* buf, size_t blocks, unsigned long long pos, unsigned char* levels) {
+    MKAR_LANE_MASKS(MKAR_AVX_SET)
+    for (size_t j = 0; j < blocks; j++, buf += MASK_BLOCK) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) buf);
+        v = _mm256_xor_si256(v, _mm256_and_si256(_mm256_slli_si256(v, 1), m1));
+        v = _mm256_xor_si256(v, _mm256_and_si256(_mm256_slli_si256(v, 2), m2));
+        v = _mm256_xor_si256(v, _mm256_and_si256(_mm256_slli_si256(v, 4), m4));
+        v = _mm256_xor_si256(v, _mm256_and_si256(_mm256_slli_si256(v, 8), m8));
+        // The low lane moves up; only byte 31 keeps it.
+        v = _mm256_xor_si256(v, _mm256_and_si256(_mm256_permute2x128_si256(v, v, 0x08), m8));
+        _mm256_storeu_si256((__m256i*) buf, v);
+        pos += MASK_BLOCK;
+        finishBlock(buf, buf, pos, levels);
+    }
+}
+
+MKAR_TARGET("avx2")
+static void fenwickDecodeAVX2(unsigned char* buf, size_t blocks, unsigned long long pos, unsigned char* levels) {
+    MKAR_LANE_MASKS(MKAR_AVX_SET)
+    unsigned char enc[MASK_BLOCK];
+    for (size_t j = 0; j < blocks; j++, buf += MASK_BLOCK) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) buf);
+        _mm256_storeu_si256((__m256i*) enc, v);
+        __m256i x = _mm256_xor_si256(v, _mm256_and_si256(_mm256_slli_si256(v, 1), m1));
+        x = _mm256_xor_si256(x, _mm256_and_si256(_mm256_slli_si256(v, 2), m2));
+        x = _mm256_xor_si256(x, _mm256_and_si256(_mm256_slli_si256(v, 4), m4));
+        x = _mm256_xor_si256(x, _mm256_and_si256(_mm256_slli_si256(v, 8), m8));
+        x = _mm256_xor_si256(x, _mm256_and_si256(_mm256_permute2x128_si256(v, v, 0x08), m8));
+        _mm256_storeu_si256((__m256i*) buf, x);
+        pos += MASK_BLOCK;
+        finishBlock(buf, enc, pos, levels);
+    }
+}
+
+MKAR_TARGET("avx2")
+static void xorScanAVX2(const unsigned char* in, unsigned char* out, size_t len, unsigned char& carry) {
+    const __m256i top = _mm256_set1_epi8(15);
+    unsigned char c = carry;
+    for (size_t i = 0; i < len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (in + i));
+        v = _mm256_xor_si256(v, _mm256_slli_si256(v, 1));
+        v = _mm256_xor_si256(v, _mm256_slli_si256(v, 2));
+        v = _mm256_xor_si256(v, _mm256_slli_si256(v, 4));
+        v = _mm256_xor_si256(v, _mm256_slli_si256(v, 8));
+        __m256i t = _mm256_shuffle_epi8(v, top);
+        v = _mm256_xor_si256(v, _mm256_permute2x128_si256(t, t, 0x08));
+        v = _mm256_xor_si256(v, _mm256_set1_epi8((char) c));
+        _mm256_storeu_si256((__m256i*) (out + i), v);
+        c = out[i + 31];
+    }
+    carry = c;
+}
+
+MKAR_TARGET("avx2")
+static void addScanAVX2(unsigned char* buf, size_t len, unsigned char& carry) {
+    const __m256i top = _mm256_set1_epi8(15);
+    unsigned char c = carry;
+    for (size_t i = 0; i < len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (buf + i));
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 1));
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 2));
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi8(v, _mm256_slli_si256(v, 8));
+        __m256i t = _mm256_shuffle_epi8(v, top);
+        v = _mm256_add_epi8(v, _mm256_permute2x128_si256(t, t, 0x08));
+        v = _mm256_add_epi8(v, _mm256_set1_epi8((char) c));
+        _mm256_storeu_si256((__m256i*) (buf + i), v);
+        c = buf[i + 31];
+    }
+    carry = c;
+}
+
+static const MaskKernels avx2Kernels = {
+    "avx2", fenwickEncodeAVX2, fenwickDecodeAVX2, xorScanAVX2, addScanAVX2
+};
+
+static bool cpuHas(const char* feature) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    if (!std::strcmp(feature, "avx2")) return __builtin_cpu_supports("avx2");
+    return __builtin_cpu_supports("sse2");
+#else
+    int info[4];
+    __cpuid(info, 1);
+    if (std::strcmp(feature, "avx2")) return (info[3] >> 26) & 1;
+    // AVX2 also needs the OS to save the ymm registers.
+    if (!((info[2] >> 27) & 1) || !((info[2] >> 28) & 1) || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] >> 5) & 1;
+#endif
+}
+
+#endif
+
+static const MaskKernels* detectKernels() {
+#ifdef MKAR_MASK_X86
+    if (cpuHas("avx2")) return &avx2Kernels;
+    if (cpuHas("sse2")) return &sse2Kernels;
+#endif
+    return &scalarKernels;
+}
+
+static const MaskKernels* activeKernels = detectKernels();
+
+const MaskKernels& maskKernels() {
+    return *activeKernels;
+}
+
+bool selectMaskKernels(const char* name) {
+    const MaskKernels* table = nullptr;
+    if (!std::strcmp(name, "scalar")) table = &scalarKernels;
+#ifdef MKAR_MASK_X86
+    else if (!std::strcmp(name, "sse2") && cpuHas("sse2")) table = &sse2Kernels;
+    else if (!std::strcmp(name, "avx2") && cpuHas("avx2")) table = &avx2Kernels;
+#endif
+    if (!table) return false;
+    activeKernels = table;
+    return true;
+}
@@ -216,7 +216,7 @@ std::string File::toString() {
 }
 
 void File::close() {
-    fs->close();
+    if (auto file = std::dynamic_pointer_cast<std::fstream>(fs)) file->close();
     isClosed = true;
 }
 
@@ -248,7 +248,7 @@ File::File(std::string name, std::string mode) : Object(Type::File), isClosed(fa
     fs = std::make_shared<std::fstream>(name.c_str(), om);
 }
 
-File::File(std::shared_ptr<std::fstream> fs) : Object(Type::File), fs(fs), isClosed(false) {}
+File::File(std::shared_ptr<std::iostream> fs) : Object(Type::File), fs(fs), isClosed(false) {}
 
 #include "env/common.hpp"
 #include "vm/vm.hpp"
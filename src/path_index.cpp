@@ -0,0 +1,58 @@
+#include "path_index.hpp"
+#include "bytes.hpp"
+
+namespace PathIndex {
+
+const size_t SLOT_SIZE = 12;
+const unsigned int EMPTY = 0xffffffff;
+
+unsigned long long hash(const std::string& path) {
+    unsigned long long h = 0xcbf29ce484222325ull;
+    for (unsigned char c : path) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+std::vector<unsigned char> build(const std::vector<std::pair<std::string, unsigned int>>& paths) {
+    size_t slots = 1;
+    while (slots < paths.size() * 2) slots <<= 1;
+
+    std::vector<unsigned char> table;
+    LE::put(table, slots, 4);
+    for (size_t i = 0; i < slots; i++) {
+        LE::put(table, 0, 8);
+        LE::put(table, EMPTY, 4);
+    }
+    for (auto& [path, fsid] : paths) {
+        unsigned long long h = hash(path);
+        size_t i = h & (slots - 1);
+        while (LE::get(table.data() + 4 + i * SLOT_SIZE + 8, 4) != EMPTY) i = (i + 1) & (slots - 1);
+        unsigned char* slot = table.data() + 4 + i * SLOT_SIZE;
+        for (size_t j = 0; j < 8; j++) slot[j] = (h >> (j << 3)) & 0xff;
+        for (size_t j = 0; j < 4; j++) slot[8 + j] = (fsid >> (j << 3)) & 0xff;
+    }
+    return table;
+}
+
+bool valid(const std::vector<unsigned char>& table) {
+    if (table.size() < 4) return false;
+    unsigned long long slots = LE::get(table.data(), 4);
+    return slots && !(slots & (slots - 1)) && (table.size() - 4) / SLOT_SIZE == slots && (table.size() - 4) % SLOT_SIZE == 0;
+}
+
+unsigned int find(const std::vector<unsigned char>& table, const std::string& path) {
+    if (table.empty()) return EMPTY;
+    size_t slots = LE::get(table.data(), 4);
+    unsigned long long h = hash(path);
+    for (size_t i = h & (slots - 1), n = 0; n < slots; i = (i + 1) & (slots - 1), n++) {
+        const unsigned char* slot = table.data() + 4 + i * SLOT_SIZE;
+        unsigned int fsid = LE::get(slot + 8, 4);
+        if (fsid == EMPTY) break;
+        if (LE::get(slot, 8) == h) return fsid;
+    }
+    return EMPTY;
+}
+
+}
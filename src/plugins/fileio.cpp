@@ -164,7 +164,7 @@ std::shared_ptr<Object> FFastIO_Get_Float(Args args) {
     return std::make_shared<Float>(f * (tmp / s));
 }
 
-void FWrite_Int_only(std::fstream& fs, long long x)
+void FWrite_Int_only(std::iostream& fs, long long x)
 {
     if(x < 0) {
         fs.put('-');
@@ -200,7 +200,7 @@ std::shared_ptr<Object> FFastIO_Print_Int(Args args) {
     return gVM->VNull;
 }
 
-void FWrite_Float_only(std::fstream& fs, double x , long long k)
+void FWrite_Float_only(std::iostream& fs, double x , long long k)
 {
     long long n = _FastPow(10 , k);
     if (x == 0)
@@ -4,6 +4,8 @@
 #include "object/integer.hpp"
 #include "object/string.hpp"
 #include "object/array.hpp"
+#include "object/bytearray.hpp"
+#include "object/file.hpp"
 #include "vm_error.hpp"
 #include "darchive.hpp"
 #include "vm/vm.hpp"
@@ -108,10 +110,57 @@ std::shared_ptr<Object> Get_Name(Args args) {
     return std::make_shared<String>(g_arch->getName(std::dynamic_pointer_cast<Integer>(args[0])->value));
 }
 
+// Resolves the path or fsid argument of the entry readers below.
+static unsigned int entryArg(Args& args, const std::string& where) {
+    if (args.size() != 1 || (args[0]->type != Object::Type::String && args[0]->type != Object::Type::Integer)) {
+        throw VMError(where, "Incorrect Format");
+    }
+    unsigned int fsid = 0;
+    if (args[0]->type == Object::Type::String) {
+        fsid = g_arch->DumpFSID(std::dynamic_pointer_cast<String>(args[0])->value);
+    }
+    else {
+        fsid = std::dynamic_pointer_cast<Integer>(args[0])->value;
+    }
+
+    if (fsid >= g_arch->FSCount() || g_arch->isDirectory(fsid)) {
+        throw VMError(where, "Unavailable Path");
+    }
+    return fsid;
+}
+
+std::shared_ptr<Object> Read_Entry(Args args) {
+    plain(args);
+    unsigned int fsid = entryArg(args, "(MKAR)Read_Entry");
+    auto [size, data] = g_arch->ReadEntry(fsid);
+    auto res = std::make_shared<ByteArray>();
+    res->value.assign(data.get(), data.get() + size);
+    return res;
+}
+
+std::shared_ptr<Object> Read_Text(Args args) {
+    plain(args);
+    unsigned int fsid = entryArg(args, "(MKAR)Read_Text");
+    auto [size, data] = g_arch->ReadEntry(fsid);
+    return std::make_shared<String>(std::string((const char*) data.get(), size));
+}
+
+// A read-only File over the decoded entry, for fgetLine and the like.
+std::shared_ptr<Object> Open_Entry(Args args) {
+    plain(args);
+    unsigned int fsid = entryArg(args, "(MKAR)Open_Entry");
+    std::shared_ptr<std::istream> entry = g_arch->OpenEntry(fsid);
+    std::shared_ptr<std::iostream> fs(new std::iostream(entry->rdbuf()), [entry](std::iostream* s) { delete s; });
+    return std::make_shared<File>(fs);
+}
+
 void Plugins::MKAR::enable() {
     regist("extract", Extract_File);
     regist("is_directory", Is_Directory);
     regist("is_symlink", Is_Symlink);
     regist("list_directory", List_Directory);
     regist("get_name", Get_Name);
+    regist("read_entry", Read_Entry);
+    regist("read_text", Read_Text);
+    regist("open_entry", Open_Entry);
 }
\ No newline at end of file
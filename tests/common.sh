@@ -0,0 +1,22 @@
+# Shared setup for the command line tests: $1 is the mkar binary. Each
+# test works in its own scratch directory, removed on exit.
+
+MKAR=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 1
+
+fail() {
+    echo "FAIL: $*" >&2
+    exit 1
+}
+
+skip() {
+    echo "SKIP: $*" >&2
+    exit 77
+}
+
+# Fails unless the two trees hold the same files with the same bytes.
+same_tree() {
+    diff -r "$1" "$2" > /dev/null || fail "$2 differs from $1"
+}
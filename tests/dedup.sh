@@ -0,0 +1,26 @@
+#!/bin/sh
+# Identical files are stored once and extract as copies, whether they are
+# packed whole or streamed, and whatever adaptive compression made of the
+# first copy.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a src/b
+head -c 300000 /dev/urandom > src/a/noise.bin
+seq 1 100000 > src/a/numbers.txt
+echo "small" > src/a/small.txt
+cp src/a/noise.bin src/a/numbers.txt src/a/small.txt src/b/
+echo "other" > src/b/other.txt
+
+for mode in "-C -A" "-C -A -b 65536" "-C -E -p 0 pw -b 65536" "-C -F 65536" "-C -A -j 4"; do
+    rm -rf out x.mkar
+    "$MKAR" x.mkar e src -U $mode > pack.log || fail "packing with [$mode] failed"
+    [ $(grep -c "^Link " pack.log) -eq 3 ] || fail "[$mode] linked $(grep -c "^Link " pack.log) files instead of 3"
+    mkdir out
+    (cd out && "$MKAR" ../x.mkar d -p 0 pw > /dev/null) || fail "extraction of [$mode] failed"
+    same_tree src out/src
+done
+
+# A streamed duplicate adds no payload of its own.
+"$MKAR" one.mkar e src/a/noise.bin -b 65536 > /dev/null || fail "packing one copy failed"
+"$MKAR" two.mkar e src/a/noise.bin src/b/noise.bin -U -b 65536 > /dev/null || fail "packing two copies failed"
+[ $(wc -c < two.mkar) -lt $(($(wc -c < one.mkar) + 4096)) ] || fail "the streamed duplicate was stored again"
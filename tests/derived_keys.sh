@@ -0,0 +1,28 @@
+#!/bin/sh
+# Entries encrypted under keys derived from the archive master key must
+# extract with the passwords of their key indexes, and only with those.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a/b
+seq 1 200000 > src/a/numbers.txt
+head -c 300000 /dev/urandom > src/a/b/noise.bin
+echo "secret" > src/a/b/secret.txt
+echo "plain" > src/plain.txt
+
+for mode in "-K" "-K -C" "-K -C -F 65536"; do
+    rm -f x.mkar
+    "$MKAR" x.mkar e src $mode -e src/a/numbers.txt 0 -e src/a/b/noise.bin 0 -e src/a/b/secret.txt 1 \
+        -p 0 pw -p 1 other > /dev/null || fail "packing with [$mode] failed"
+    for flags in "" "-j 4"; do
+        rm -rf out
+        mkdir out
+        (cd out && "$MKAR" ../x.mkar d -p 0 pw -p 1 other $flags > /dev/null) || fail "extraction of [$mode] with [$flags] failed"
+        same_tree src out/src
+    done
+    # A wrong password for index 1 is detected and asked for again.
+    rm -rf out
+    mkdir out
+    (cd out && echo other | "$MKAR" ../x.mkar d -p 0 pw -p 1 wrong > ../extract.log) || fail "extraction of [$mode] after a retry failed"
+    grep -q "key for index 1 is incorrect" extract.log || fail "a wrong password for index 1 was accepted with [$mode]"
+    same_tree src out/src
+done
@@ -0,0 +1,41 @@
+#!/bin/sh
+# A trained dictionary combined with adaptive levels: every bucket is hit
+# and everything extracts unchanged.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/json
+i=0
+while [ $i -lt 200 ]; do
+    printf '{"id": %d, "name": "entry %d", "tags": ["alpha", "beta"], "enabled": true}\n' $i $((i * 7)) > src/json/$i.json
+    i=$((i + 1))
+done
+head -c 200000 /dev/urandom > src/noise.bin
+seq 1 100000 > src/numbers.txt
+head -c 60000 /dev/urandom | base64 > src/base64.txt
+
+"$MKAR" x.mkar e src -C -D 16384 -A > pack.log || fail "packing failed"
+grep -q "Trained a" pack.log || fail "no dictionary was trained"
+grep -q "Adaptive: [1-9][0-9]* stored, [1-9][0-9]* fast, [1-9][0-9]* high" pack.log || fail "adaptive buckets: $(grep Adaptive pack.log)"
+
+mkdir out
+(cd out && "$MKAR" ../x.mkar d > /dev/null) || fail "extraction failed"
+same_tree src out/src
+
+"$MKAR" y.mkar e src -C -D 16384 -A -j 4 > /dev/null || fail "parallel packing failed"
+mkdir out2
+(cd out2 && "$MKAR" ../y.mkar d > /dev/null) || fail "parallel extraction failed"
+same_tree src out2/src
+
+# Level 0 is zstd's default level, not "store".
+"$MKAR" z.mkar e src/numbers.txt -C -A -L 0 > /dev/null || fail "packing at level 0 failed"
+[ $(wc -c < z.mkar) -lt $(($(wc -c < src/numbers.txt) / 4)) ] || fail "level 0 stored compressible data"
+
+# A level equal to the fast one still keeps the buckets apart.
+"$MKAR" w.mkar e src -C -A -L 3 > pack3.log || fail "packing at level 3 failed"
+grep -q "Adaptive: [1-9][0-9]* stored, [1-9][0-9]* fast, [1-9][0-9]* high" pack3.log || fail "adaptive buckets at level 3: $(grep Adaptive pack3.log)"
+
+# Directories and empty files are never probed.
+mkdir -p bare/dir
+: > bare/empty.txt
+"$MKAR" v.mkar e bare -C -A > bare.log || fail "packing empty entries failed"
+grep -q "Adaptive: 0 stored, 0 fast, 0 high" bare.log || fail "empty entries were counted: $(grep Adaptive bare.log)"
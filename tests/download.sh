@@ -0,0 +1,74 @@
+#!/bin/sh
+# NETWORK entries are fetched on extraction; failed transfers must fail the
+# run and an interrupted one must resume from its .part.
+TESTS=$(cd "$(dirname "$0")" && pwd)
+. "$TESTS/common.sh"
+
+command -v python3 > /dev/null || skip "no python3"
+unset http_proxy https_proxy HTTP_PROXY HTTPS_PROXY ALL_PROXY all_proxy
+
+mkdir -p www/short
+head -c 150000 /dev/urandom > www/whole.bin
+head -c 200000 /dev/urandom > www/short/cut.bin
+python3 "$TESTS/http_server.py" www port ranges 2> /dev/null &
+server=$!
+trap 'kill $server 2> /dev/null; rm -rf "$WORK"' EXIT
+tries=0
+until [ -s port ]; do
+    kill -0 $server 2> /dev/null || skip "the HTTP server did not start"
+    tries=$((tries + 1))
+    [ $tries -le 50 ] || skip "the HTTP server did not start"
+    sleep 0.1
+done
+base=http://127.0.0.1:$(cat port)
+
+mkdir -p src/net
+echo "local" > src/local.txt
+echo "$base/whole.bin" > src/net/whole.bin
+echo "$base/short/cut.bin" > src/net/cut.bin
+"$MKAR" x.mkar e src -n src/net/whole.bin -n src/net/cut.bin > /dev/null || fail "packing failed"
+
+# The short response fails the run but keeps what arrived.
+mkdir out
+if (cd out && "$MKAR" ../x.mkar d > /dev/null 2>&1); then
+    fail "a short response was accepted"
+fi
+cmp -s www/whole.bin out/src/net/whole.bin || fail "whole.bin differs"
+[ ! -e out/src/net/cut.bin ] || fail "a short download was renamed into place"
+[ -s out/src/net/cut.bin.part ] || fail "no .part kept for the short download"
+
+# The next run asks for the rest with a Range request.
+(cd out && "$MKAR" ../x.mkar d > /dev/null) || fail "resuming failed"
+cmp -s www/short/cut.bin out/src/net/cut.bin || fail "the resumed cut.bin differs"
+[ ! -e out/src/net/cut.bin.part ] || fail "the .part was left behind"
+grep -q "^/short/cut.bin bytes=" ranges || fail "no Range request for cut.bin"
+
+# A .part longer than the file gets a 416 and is fetched again whole.
+rm src/net/cut.bin
+"$MKAR" w.mkar e src -n src/net/whole.bin > /dev/null || fail "packing failed"
+mkdir -p stale/src/net
+head -c 160000 /dev/urandom > stale/src/net/whole.bin.part
+(cd stale && "$MKAR" ../w.mkar d > /dev/null) || fail "a stale .part was not refetched"
+cmp -s www/whole.bin stale/src/net/whole.bin || fail "the refetched whole.bin differs"
+grep -q "^/whole.bin bytes=160000-" ranges || fail "the stale .part was not offered to the server"
+
+# A priority-0 script runs only once the downloads before it are done.
+mkdir -p first www/slow
+cp www/whole.bin www/slow/late.bin
+echo "$base/slow/late.bin" > first/late.bin
+echo 'system("cmp -s first/late.bin ../www/whole.bin && touch seen");' > check.mk
+"$MKAR" s.mkar e first check.mk -n first/late.bin -s check.mk 0 > /dev/null || fail "packing failed"
+mkdir script
+(cd script && "$MKAR" ../s.mkar d > /dev/null) || fail "extraction with a script failed"
+[ -e script/seen ] || fail "the script ran before the download finished"
+
+# A 404 fails the run and writes nothing under the entry's name.
+rm -rf src
+mkdir -p src/net
+echo "$base/missing.bin" > src/net/missing.bin
+"$MKAR" y.mkar e src -n src/net/missing.bin > /dev/null || fail "packing failed"
+mkdir gone
+if (cd gone && "$MKAR" ../y.mkar d > /dev/null 2>&1); then
+    fail "a 404 was accepted"
+fi
+[ ! -e gone/src/net/missing.bin ] || fail "a 404 body was saved"
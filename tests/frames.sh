@@ -0,0 +1,27 @@
+#!/bin/sh
+# Framed entries must extract whole and serve any byte range; the second
+# argument is the read_range checker built beside mkar.
+. "$(dirname "$0")/common.sh"
+
+READ_RANGE=$2
+[ -x "$READ_RANGE" ] || fail "no read_range checker given"
+
+mkdir -p src/a/b
+seq 1 200000 > src/a/numbers.txt
+seq 200000 -1 1 > src/a/b/reversed.txt
+head -c 300000 /dev/urandom > src/a/b/noise.bin
+head -c 65536 /dev/urandom > src/a/b/one_frame.bin
+echo "small" > src/small.txt
+: > src/empty.txt
+
+for mode in "-F 65536" "-F 4096 -C" "-F 65536 -C -E -p 0 pw" "-F 65536 -C -E -K -p 0 pw" "-F 65536 -C -j 4"; do
+    rm -f x.mkar
+    "$MKAR" x.mkar e src $mode > /dev/null 2>&1 || fail "packing with [$mode] failed"
+    for flags in "" "-j 4" "-b 4096"; do
+        rm -rf out
+        mkdir out
+        (cd out && "$MKAR" ../x.mkar d -p 0 pw $flags > /dev/null) || fail "extraction of [$mode] with [$flags] failed"
+        same_tree src out/src
+    done
+    "$READ_RANGE" x.mkar . pw || fail "ranges of [$mode] differ"
+done
@@ -0,0 +1,39 @@
+#!/bin/sh
+# A mounted archive must show the packed tree, also to concurrent readers.
+. "$(dirname "$0")/common.sh"
+
+[ -c /dev/fuse ] || skip "no /dev/fuse"
+command -v fusermount3 > /dev/null || skip "no fusermount3"
+
+mkdir -p src/a/b
+seq 1 200000 > src/a/numbers.txt
+seq 200000 -1 1 > src/a/b/reversed.txt
+head -c 300000 /dev/urandom > src/a/b/noise.bin
+echo "first" > src/first.txt
+
+"$MKAR" x.mkar e src -C -E -F 65536 -p 0 pw > /dev/null || fail "packing failed"
+
+mkdir mnt
+"$MKAR" x.mkar m mnt -p 0 pw > /dev/null 2>&1 &
+pid=$!
+trap 'fusermount3 -u "$WORK/mnt" 2> /dev/null; wait $pid; rm -rf "$WORK"' EXIT
+tries=0
+until [ -d mnt/src ]; do
+    kill -0 $pid 2> /dev/null || skip "mounting is not permitted here"
+    tries=$((tries + 1))
+    [ $tries -le 50 ] || fail "the mount did not come up"
+    sleep 0.2
+done
+
+same_tree src mnt/src
+readers=
+for file in a/numbers.txt a/b/reversed.txt a/b/noise.bin; do
+    for i in 1 2 3; do
+        { cmp -s "src/$file" "mnt/src/$file" || echo "$file" >> bad; } &
+        readers="$readers $!"
+    done
+done
+for reader in $readers; do wait $reader; done
+[ ! -s bad ] || fail "concurrent reads differ: $(sort -u bad | tr '\n' ' ')"
+dd if=mnt/src/a/numbers.txt bs=1 skip=65500 count=100 2> /dev/null > part
+dd if=src/a/numbers.txt bs=1 skip=65500 count=100 2> /dev/null | cmp -s - part || fail "a read across frames differs"
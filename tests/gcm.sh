@@ -0,0 +1,33 @@
+#!/bin/sh
+# AES-GCM entries must round-trip, and a flipped byte in one must fail the
+# run without leaving the unverified plaintext behind.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a/b
+seq 1 200000 > src/a/numbers.txt
+head -c 300000 /dev/urandom > src/a/b/noise.bin
+echo "first" > src/first.txt
+
+for mode in "-G -E" "-G -E -C" "-G -E -C -F 65536" "-G -K -E -C"; do
+    rm -f x.mkar
+    "$MKAR" x.mkar e src $mode -p 0 pw > /dev/null 2>&1 || fail "packing with [$mode] failed"
+    for flags in "" "-j 4" "-b 4096"; do
+        rm -rf out
+        mkdir out
+        (cd out && "$MKAR" ../x.mkar d -p 0 pw $flags > /dev/null) || fail "extraction of [$mode] with [$flags] failed"
+        same_tree src out/src
+    done
+done
+
+rm -rf src/a
+head -c 300000 /dev/urandom > src/noise.bin
+"$MKAR" t.mkar e src -G -E -p 0 pw > /dev/null 2>&1 || fail "packing failed"
+printf '\377' | dd of=t.mkar bs=1 seek=150000 conv=notrunc 2> /dev/null
+for flags in "" "-b 4096"; do
+    rm -rf out
+    mkdir out
+    if (cd out && "$MKAR" ../t.mkar d -p 0 pw $flags < /dev/null > /dev/null 2>&1); then
+        fail "a tampered entry was accepted with [$flags]"
+    fi
+    [ ! -e out/src/noise.bin ] || fail "a tampered entry was written with [$flags]"
+done
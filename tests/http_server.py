@@ -0,0 +1,56 @@
+"""Loopback HTTP server for download.sh.
+
+Serves the files under argv[1] with byte-range support and writes the port
+it listens on to argv[2]. Files under /short/ are cut in half unless a
+Range request asks for the rest, and files under /slow/ are sent after a
+second. Every Range header is logged to argv[3].
+"""
+import http.server
+import os
+import re
+import sys
+import time
+
+root, port_file, log_file = sys.argv[1:4]
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    def log_message(self, *args):
+        pass
+
+    def reply(self, code, body=b"", length=None, headers=()):
+        self.send_response(code)
+        for name, value in headers:
+            self.send_header(name, value)
+        self.send_header("Content-Length", str(len(body) if length is None else length))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        path = os.path.join(root, self.path.lstrip("/"))
+        if not os.path.isfile(path):
+            return self.reply(404)
+        with open(path, "rb") as f:
+            data = f.read()
+        if self.path.startswith("/slow/"):
+            time.sleep(1)
+
+        match = re.match(r"bytes=(\d+)-$", self.headers.get("Range", ""))
+        if match:
+            with open(log_file, "a") as log:
+                log.write(f"{self.path} {match.group(0)}\n")
+            start = int(match.group(1))
+            if start >= len(data):
+                return self.reply(416, headers=[("Content-Range", f"bytes */{len(data)}")])
+            return self.reply(206, data[start:], headers=[("Content-Range", f"bytes {start}-{len(data) - 1}/{len(data)}")])
+        if self.path.startswith("/short/"):
+            # Announce the whole file, then drop the connection halfway.
+            return self.reply(200, data[:len(data) // 2], length=len(data))
+        self.reply(200, data)
+
+
+server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+with open(port_file + ".tmp", "w") as f:
+    f.write(str(server.server_address[1]))
+os.rename(port_file + ".tmp", port_file)
+server.serve_forever()
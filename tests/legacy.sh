@@ -0,0 +1,32 @@
+#!/bin/sh
+# tests/data/v2.mkar was packed by the version 2 writer from the tree built
+# below, with
+#   mkar v2.mkar e src -c src/numbers.txt -c src/a/b/both.txt \
+#       -e src/a/secret.txt 0 -e src/a/b/both.txt 0 -p 0 pw
+# and must keep extracting; updating it is refused without touching it.
+DATA=$(cd "$(dirname "$0")/data" && pwd)
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a/b src/c
+seq 1 20000 > src/numbers.txt
+seq 1 3 300 > src/a/secret.txt
+seq 2 2 5000 > src/a/b/both.txt
+: > src/c/empty.txt
+cp "$DATA/v2.mkar" x.mkar
+
+for flags in "" "-j 4" "-b 4096"; do
+    rm -rf out
+    mkdir out
+    (cd out && "$MKAR" ../x.mkar d -p 0 pw $flags > /dev/null) || fail "extraction with [$flags] failed"
+    same_tree src out/src
+done
+rm -rf out
+mkdir out
+(cd out && "$MKAR" ../x.mkar d -p 0 pw src/a/b/both.txt both.txt > /dev/null) || fail "extracting a mentioned path failed"
+cmp -s src/a/b/both.txt out/both.txt || fail "the mentioned file differs"
+
+echo "new" > src/new.txt
+if "$MKAR" x.mkar u src -p 0 pw > /dev/null 2>&1; then
+    fail "a version 2 archive was updated"
+fi
+cmp -s "$DATA/v2.mkar" x.mkar || fail "a refused update changed the archive"
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Extracting with worker threads must give the tree a serial run gives,
+# for whole, streamed and linked entries and for single mentioned paths.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a/b src/c
+i=0
+while [ $i -lt 100 ]; do
+    seq $i $((i * 50)) > src/c/$i.txt
+    i=$((i + 1))
+done
+seq 1 200000 > src/a/numbers.txt
+head -c 300000 /dev/urandom > src/a/b/noise.bin
+: > src/a/empty.txt
+printf 'src/a/numbers.txt' > src/link
+# A symlink extracts as a copy of its target.
+cp -r src expect
+cp src/a/numbers.txt expect/link
+
+for mode in "-C" "-C -E -p 0 pw"; do
+    rm -rf x.mkar
+    "$MKAR" x.mkar e src -l src/link $mode > /dev/null || fail "packing with [$mode] failed"
+    for flags in "-j 4" "-j 4 -b 4096"; do
+        rm -rf out
+        mkdir out
+        (cd out && "$MKAR" ../x.mkar d -p 0 pw $flags > /dev/null) || fail "extraction of [$mode] with [$flags] failed"
+        same_tree expect out/src
+    done
+    rm -rf part
+    mkdir part
+    (cd part && "$MKAR" ../x.mkar d -p 0 pw -j 4 src/a a src/c/7.txt seven.txt > /dev/null) || fail "extraction of mentioned paths from [$mode] failed"
+    same_tree src/a part/a
+    cmp -s src/c/7.txt part/seven.txt || fail "the mentioned file differs in [$mode]"
+done
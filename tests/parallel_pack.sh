@@ -0,0 +1,32 @@
+#!/bin/sh
+# Packing with worker threads must produce archives that extract to the
+# same tree, and an entry that can't be packed must fail the run.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a/b src/c
+i=0
+while [ $i -lt 100 ]; do
+    seq $i $((i * 50)) > src/c/$i.txt
+    i=$((i + 1))
+done
+seq 1 200000 > src/a/numbers.txt
+head -c 300000 /dev/urandom > src/a/b/noise.bin
+: > src/a/empty.txt
+
+for mode in "" "-C" "-C -E -p 0 pw" "-C -b 65536"; do
+    rm -rf out x.mkar
+    "$MKAR" x.mkar e src -j 4 $mode > /dev/null || fail "packing with [$mode] failed"
+    mkdir out
+    (cd out && "$MKAR" ../x.mkar d -p 0 pw > /dev/null) || fail "extraction of [$mode] failed"
+    same_tree src out/src
+done
+
+# A FIFO has no size to read, so its entry fails to pack.
+mkfifo src/pipe || skip "no mkfifo"
+rm -f x.mkar
+for threads in 1 4; do
+    if "$MKAR" x.mkar e src -j $threads > /dev/null 2> err.log; then
+        fail "a failed entry was reported as success with -j $threads"
+    fi
+    grep -q "could not be packed" err.log || fail "no error reported with -j $threads"
+done
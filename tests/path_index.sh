@@ -0,0 +1,30 @@
+#!/bin/sh
+# Mentioned paths must resolve to the same entries with and without the
+# path index, including names repeated under other parents.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a/b src/c/a/b src/d
+seq 1 1000 > src/a/b/x.txt
+seq 5 2000 > src/c/a/b/x.txt
+seq 9 3000 > src/d/x.txt
+echo "top" > src/x.txt
+
+for index in "" "-i"; do
+    rm -f x.mkar
+    "$MKAR" x.mkar e src -C $index > /dev/null 2>&1 || fail "packing with [$index] failed"
+    rm -rf out
+    mkdir out
+    for path in a/b/x.txt c/a/b/x.txt d/x.txt x.txt; do
+        name=$(echo "$path" | tr / _)
+        (cd out && "$MKAR" ../x.mkar d "src/$path" "$name" > /dev/null 2>&1) || fail "extracting src/$path with [$index] failed"
+        cmp -s "src/$path" "out/$name" || fail "src/$path resolved to another entry with [$index]"
+    done
+    (cd out && "$MKAR" ../x.mkar d src/c/a c_a > /dev/null 2>&1) || fail "extracting a directory with [$index] failed"
+    same_tree src/c/a out/c_a
+    for path in src/a/x.txt a/b/x.txt src/c/b/x.txt src/nope; do
+        if (cd out && "$MKAR" ../x.mkar d "$path" missing > /dev/null 2>&1); then
+            fail "the missing path $path was found with [$index]"
+        fi
+    done
+    [ ! -e out/missing ] || fail "a missing path wrote output with [$index]"
+done
@@ -0,0 +1,81 @@
+// Reads every file entry of an archive through ReadRange and OpenEntry
+// and compares the bytes with the tree it was packed from.
+//
+//   read_range <archive> <dir holding the packed tree> [password for index 0]
+
+#include "darchive.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& path, const char* what, unsigned long long offset, size_t len) {
+    if (ok) return;
+    std::fprintf(stderr, "%s: %s differs at %llu+%zu\n", path.c_str(), what, offset, len);
+    failures++;
+}
+
+static void checkRange(DArchive& arch, const DArchive::Entry& entry, const std::vector<unsigned char>& ref, unsigned long long offset, size_t len) {
+    std::vector<unsigned char> buf(len);
+    size_t got = arch.ReadRange(entry.fsid, offset, buf.data(), len);
+    size_t expect = offset < ref.size() ? std::min<unsigned long long>(len, ref.size() - offset) : 0;
+    check(got == expect && std::equal(buf.begin(), buf.begin() + got, ref.begin() + std::min<unsigned long long>(offset, ref.size())),
+        entry.path, "ReadRange", offset, len);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::fprintf(stderr, "usage: %s <archive> <dir> [password]\n", argv[0]);
+        return 2;
+    }
+    try {
+        DArchive arch(argv[1], true);
+        arch.SetPasswordCallbacks([](unsigned int) { return false; }, [](unsigned int) { return false; });
+        if (argc > 3) arch.SetKey(0, argv[3]);
+        arch.FSTable();
+        arch.TestRootdir();
+
+        std::mt19937 rng(1);
+        int files = 0;
+        for (const auto& entry : arch) {
+            if (entry.directory || entry.symlink) continue;
+            std::ifstream is(std::string(argv[2]) + "/" + entry.path, std::ios::binary);
+            std::vector<unsigned char> ref((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+            files++;
+            check(arch.getSize(entry.fsid) == ref.size(), entry.path, "getSize", 0, ref.size());
+
+            // Edges of the usual frame sizes, then random spans.
+            for (unsigned long long edge : {0ULL, 4096ULL, 65536ULL, 131072ULL, (unsigned long long) ref.size()}) {
+                for (unsigned long long offset : {edge ? edge - 1 : 0, edge}) {
+                    checkRange(arch, entry, ref, offset, 2);
+                    checkRange(arch, entry, ref, offset, 70000);
+                }
+            }
+            for (int k = 0; k < 50; k++) {
+                checkRange(arch, entry, ref, rng() % (ref.size() + 100), rng() % 150000);
+            }
+
+            auto stream = arch.OpenEntry(entry.fsid);
+            std::vector<unsigned char> whole((std::istreambuf_iterator<char>(*stream)), std::istreambuf_iterator<char>());
+            check(whole == ref, entry.path, "OpenEntry", 0, ref.size());
+            stream->clear();
+            stream->seekg(ref.size() / 2);
+            std::vector<unsigned char> tail((std::istreambuf_iterator<char>(*stream)), std::istreambuf_iterator<char>());
+            check(tail.size() == ref.size() - ref.size() / 2 && std::equal(tail.begin(), tail.end(), ref.begin() + ref.size() / 2), entry.path, "OpenEntry after seekg", ref.size() / 2, tail.size());
+        }
+        if (!files) {
+            std::fprintf(stderr, "no file entries\n");
+            return 1;
+        }
+    }
+    catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return failures ? 1 : 0;
+}
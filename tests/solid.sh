@@ -0,0 +1,38 @@
+#!/bin/sh
+# Small files packed into solid blocks must extract like any other entry,
+# whole or mentioned one at a time, serially and with worker threads.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a/b src/c
+i=0
+while [ $i -lt 200 ]; do
+    seq $i $((i * 3)) > src/c/$i.txt
+    i=$((i + 1))
+done
+seq 1 200000 > src/a/numbers.txt
+head -c 5000 /dev/urandom > src/a/b/noise.bin
+: > src/a/empty.txt
+
+for mode in "-C -S 65536" "-C -S 4096" "-C -E -S 65536 -p 0 pw" "-C -S 65536 -j 4"; do
+    rm -f x.mkar
+    "$MKAR" x.mkar e src $mode > /dev/null 2>&1 || fail "packing with [$mode] failed"
+    for flags in "" "-j 4"; do
+        rm -rf out
+        mkdir out
+        (cd out && "$MKAR" ../x.mkar d -p 0 pw $flags > /dev/null) || fail "extraction of [$mode] with [$flags] failed"
+        same_tree src out/src
+    done
+    rm -rf out
+    mkdir out
+    (cd out && "$MKAR" ../x.mkar d -p 0 pw -j 4 src/c/150.txt one.txt src/c/7.txt seven.txt src/a/b b > /dev/null) \
+        || fail "extracting solid members of [$mode] failed"
+    cmp -s src/c/150.txt out/one.txt || fail "a mentioned solid member of [$mode] differs"
+    cmp -s src/c/7.txt out/seven.txt || fail "a mentioned solid member of [$mode] differs"
+    same_tree src/a/b out/b
+done
+
+# Sharing one zstd frame must pay off for the small files.
+rm -rf src/a
+"$MKAR" loose.mkar e src -C > /dev/null 2>&1 || fail "packing without solid blocks failed"
+"$MKAR" solid.mkar e src -C -S 65536 > /dev/null 2>&1 || fail "packing with solid blocks failed"
+[ $(wc -c < solid.mkar) -lt $(wc -c < loose.mkar) ] || fail "solid blocks did not shrink the archive"
@@ -0,0 +1,23 @@
+#!/bin/sh
+# An update that fails halfway must leave the archive as it was.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a
+seq 1 20000 > src/a/numbers.txt
+echo "first" > src/first.txt
+cp -r src expect
+
+"$MKAR" x.mkar e src -C -E -p 0 pw > /dev/null || fail "packing failed"
+cp x.mkar before.mkar
+seq 1 50000 > src/a/more.txt
+# No password for the new entries: a streamed entry throws once its
+# header is already written.
+if "$MKAR" x.mkar u src -C -E -b 4096 > /dev/null 2>&1; then
+    fail "update without a password was accepted"
+fi
+
+cmp -s before.mkar x.mkar || fail "the failed update changed the archive"
+
+mkdir out
+(cd out && "$MKAR" ../x.mkar d -p 0 pw > /dev/null) || fail "extraction after the failed update failed"
+same_tree expect out/src
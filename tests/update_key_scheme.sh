@@ -0,0 +1,27 @@
+#!/bin/sh
+# Updating a per-entry PBKDF2 archive must not switch its key index to
+# another scheme: the old entries would no longer decrypt.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a
+seq 1 20000 > src/a/numbers.txt
+echo "first" > src/first.txt
+cp -r src expect
+
+"$MKAR" x.mkar e src -C -E -p 0 pw > /dev/null || fail "packing failed"
+echo "second" > src/second.txt
+for scheme in -K -G; do
+    if "$MKAR" x.mkar u src -C -E -p 0 pw $scheme > /dev/null 2>&1; then
+        fail "update with $scheme was accepted"
+    fi
+    rm -rf out
+    mkdir out
+    (cd out && "$MKAR" ../x.mkar d -p 0 pw > /dev/null) || fail "extraction after a refused $scheme update failed"
+    same_tree expect out/src
+done
+
+"$MKAR" x.mkar u src -C -E -p 0 pw > /dev/null || fail "plain update failed"
+rm -rf out
+mkdir out
+(cd out && "$MKAR" ../x.mkar d -p 0 pw > /dev/null) || fail "extraction after the update failed"
+same_tree src out/src
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Moving an unchanged file to another key index must re-encrypt it, not
+# keep the old entry under the old index.
+. "$(dirname "$0")/common.sh"
+
+mkdir -p src/a
+seq 1 20000 > src/a/numbers.txt
+echo "first" > src/first.txt
+
+"$MKAR" x.mkar e src -C -e src/a/numbers.txt 0 -p 0 pw > /dev/null || fail "packing failed"
+"$MKAR" x.mkar u src -C -e src/a/numbers.txt 1 -p 1 other > /dev/null || fail "update failed"
+
+mkdir out
+(cd out && echo other | "$MKAR" ../x.mkar d -p 0 pw > ../extract.log) || fail "extraction after the update failed"
+grep -q "key for index 1" extract.log || fail "the entry kept its old key index"
+same_tree src out/src
+
+# Updating again with the same index reuses the entry.
+"$MKAR" x.mkar u src -C -e src/a/numbers.txt 1 -p 1 other > update.log || fail "second update failed"
+! grep -q "numbers.txt" update.log || fail "an unchanged entry was packed again"